@@ -0,0 +1,113 @@
+#include "Index.h"
+#include "assert.h"
+#include <stdlib.h>
+#include <sys/mman.h>
+
+/*-----------------------------------------------------------------------------
+| Node memory of an index.
+| Every context owns an arena (struct RTreeArena in Index.h): nodes are cut
+| one after the other from large slabs instead of being malloc'ed one by
+| one, nodes released by deletes and splits go to a free list and are
+| reused first, and the whole index is released with RTreeFreeIndex in one
+| free per slab. Slabs can be backed by (transparent) huge pages, which cuts
+| the TLB misses of queries on large trees.
+-----------------------------------------------------------------------------*/
+
+#define RTREE_SLAB_SIZE (64 * 1024)            /* regular slab */
+#define RTREE_HUGE_SLAB_SIZE (2 * 1024 * 1024) /* one x86-64 huge page */
+#define RTREE_ARENA_ALIGN 64                   /* cache line */
+
+void RTreeInitArena(struct RTreeArena *a, int hugePages) {
+  a->slabs = NULL;
+  a->next = a->end = NULL;
+  a->freeNodes = NULL;
+  a->freeListNodes = NULL;
+  a->slabCount = 0;
+  a->hugePages = hugePages;
+}
+
+// Starts a new slab. Its first bytes link it to the previous slabs.
+static int RTreeArenaGrow(struct RTreeArena *a) {
+  size_t size = a->hugePages ? RTREE_HUGE_SLAB_SIZE : RTREE_SLAB_SIZE;
+  void *slab;
+
+  if (posix_memalign(&slab, a->hugePages ? RTREE_HUGE_SLAB_SIZE : 4096,
+                     size) != 0)
+    return 0;
+#ifdef MADV_HUGEPAGE
+  if (a->hugePages)
+    madvise(slab, size, MADV_HUGEPAGE); /* only a hint, may be refused */
+#endif
+  *(void **)slab = a->slabs;
+  a->slabs = slab;
+  a->next = (char *)slab + RTREE_ARENA_ALIGN;
+  a->end = (char *)slab + size;
+  a->slabCount++;
+  return 1;
+}
+
+// Returns size bytes (aligned on a cache line) from the newest slab.
+// Memory is only given back by RTreeFreeIndex, use the free lists to
+// recycle it.
+void *RTreeArenaAlloc(struct RTreeArena *a, size_t size) {
+  void *p;
+
+  size = (size + RTREE_ARENA_ALIGN - 1) & ~(size_t)(RTREE_ARENA_ALIGN - 1);
+  assert(size <= RTREE_SLAB_SIZE - RTREE_ARENA_ALIGN);
+  if ((size_t)(a->end - a->next) < size && !RTreeArenaGrow(a))
+    return NULL;
+  p = a->next;
+  a->next += size;
+  return p;
+}
+
+// Free lists are linked through the first word of the released blocks.
+void RTreeArenaPush(void **list, void *p) {
+  *(void **)p = *list;
+  *list = p;
+}
+
+void *RTreeArenaPop(void **list) {
+  void *p = *list;
+  if (p)
+    *list = *(void **)p;
+  return p;
+}
+
+// Moves all the memory of src (slabs and free blocks) to dst, e.g. when
+// the subtrees built by several threads, each with its own context, become
+// parts of one index. src is left empty.
+void RTreeArenaMerge(struct RTreeArena *dst, struct RTreeArena *src) {
+  void *p;
+
+  while (src->slabs) {
+    void *slab = src->slabs;
+    src->slabs = *(void **)slab;
+    *(void **)slab = dst->slabs;
+    dst->slabs = slab;
+    dst->slabCount++;
+  }
+  while ((p = RTreeArenaPop(&src->freeNodes)))
+    RTreeArenaPush(&dst->freeNodes, p);
+  while ((p = RTreeArenaPop(&src->freeListNodes)))
+    RTreeArenaPush(&dst->freeListNodes, p);
+  RTreeInitArena(src, src->hugePages);
+}
+
+// Releases every node allocated with the context, i.e. the whole index (or
+// all the indexes) built with it. The context can be used again afterwards.
+void RTreeFreeIndex(struct RTreeContext *c) {
+  struct RTreeArena *a = &c->arena;
+
+  while (a->slabs) {
+    void *slab = a->slabs;
+    a->slabs = *(void **)slab;
+    free(slab);
+  }
+  RTreeInitArena(a, a->hugePages);
+}
+
+// Back the slabs allocated from now on by huge pages (on = 1) or not.
+void RTreeSetHugePages(struct RTreeContext *c, int on) {
+  c->arena.hugePages = on;
+}
@@ -0,0 +1,153 @@
+#include "CARD.H"
+#include "Index.h"
+#include "assert.h"
+#include <math.h>
+#include <stdlib.h>
+
+/*-----------------------------------------------------------------------------
+| Bulk loading (packing) of a whole index in one pass.
+| Instead of inserting data rects one at a time (RTreeInsertRect, which runs
+| RTreePickBranch from the root and splits full nodes), all the entries of a
+| level are ordered once and then cut into consecutive, fully packed nodes.
+| The covers of those nodes become the entries of the level above, and so on
+| until a single root is left. The result is a normal tree of struct Node,
+| usable by RTreeSearch and the other routines unchanged.
+-----------------------------------------------------------------------------*/
+
+// Compare two branches by the center of their MBR along x (resp. y).
+// Sums are used instead of centers, the factor 1/2 does not change the order.
+static int RTreeCompareCenterX(const void *A, const void *B) {
+  const struct Rect *a = &((const struct Branch *)A)->rect;
+  const struct Rect *b = &((const struct Branch *)B)->rect;
+  RectReal ca = a->boundary[0] + a->boundary[NUMDIMS];
+  RectReal cb = b->boundary[0] + b->boundary[NUMDIMS];
+  return (ca > cb) - (ca < cb);
+}
+
+static int RTreeCompareCenterY(const void *A, const void *B) {
+  const struct Rect *a = &((const struct Branch *)A)->rect;
+  const struct Rect *b = &((const struct Branch *)B)->rect;
+  RectReal ca = a->boundary[1] + a->boundary[1 + NUMDIMS];
+  RectReal cb = b->boundary[1] + b->boundary[1 + NUMDIMS];
+  return (ca > cb) - (ca < cb);
+}
+
+// Sort-Tile-Recursive ordering of n branches that will be packed into nodes
+// of cap entries: sort by x, cut into ceil(sqrt(pages)) vertical slabs of
+// whole pages, then sort every slab by y.
+// Also used to lay out the wide nodes of a quantized index (Quant.c).
+void RTreeTileSTR(struct Branch *b, RTreeId n, int cap) {
+  RTreeId pages = (n + cap - 1) / cap;
+  RTreeId slabs = (RTreeId)ceil(sqrt((double)pages));
+  RTreeId slab = slabs * cap; // entries per slab, always a multiple of cap
+  RTreeId i;
+
+  qsort(b, n, sizeof(struct Branch), RTreeCompareCenterX);
+  for (i = 0; i < n; i += slab)
+    qsort(b + i, (n - i < slab) ? n - i : slab, sizeof(struct Branch),
+          RTreeCompareCenterY);
+}
+
+// Cut n ordered branches into consecutive nodes of the given level.
+// Every node is full except the last two, which share the remainder so that
+// both stay above the minimum fill (keeps later deletes well behaved).
+// The covers of the new nodes are written back at the front of b
+// (node k only reads entries at index >= k, so this is safe in place).
+// Returns the number of nodes created.
+// Exported so that callers can pack disjoint ranges of one level
+// concurrently (see BuildRTreeParallel) before packing the levels above;
+// the nodes come from the arena of c, so every thread needs its own context
+// (see RTreeArenaMerge).
+RTreeId RTreePackLevel(struct RTreeContext *c, struct Branch *b, RTreeId n,
+                       int level) {
+  int cap = level > 0 ? NODECARD(c) : LEAFCARD(c);
+  int minfill = level > 0 ? MinNodeFill(c) : MinLeafFill(c);
+  RTreeId i = 0, k = 0;
+  int j;
+
+  while (i < n) {
+    int take = cap;
+    struct Node *node;
+
+    if (n - i <= cap)
+      take = (int)(n - i);
+    else if (n - i - cap < minfill) // remainder would be underfull, share it
+      take = (int)((n - i) / 2);
+
+    node = RTreeNewNode(c);
+    node->level = level;
+    for (j = 0; j < take; j++)
+      node->branch[j] = b[i + j];
+    node->count = take;
+
+    b[k].rect = RTreeNodeCover(node);
+    b[k].child = node;
+    k++;
+    i += take;
+  }
+  return k;
+}
+
+// Copy the data rects and their IDs into a branch buffer for the packer.
+static struct Branch *RTreeLoadEntries(struct Rect *rects, RTreeId *ids,
+                                       RTreeId n) {
+  struct Branch *b = (struct Branch *)malloc(n * sizeof(struct Branch));
+  RTreeId i;
+  assert(b);
+  for (i = 0; i < n; i++) {
+    b[i].rect = rects[i];
+    b[i].child = NULL; /* clears the whole payload */
+    b[i].id = ids[i];
+  }
+  return b;
+}
+
+// Build an index from n data rects with the Sort-Tile-Recursive algorithm
+// (Leutenegger, Lopez & Edgington, 1997). ids[i] is stored as the data ID of
+// rects[i] and, as for RTreeInsertRect, MUST NEVER BE ZERO.
+// Every level is tiled again from the covers of the level below.
+// Returns the root of the new tree.
+//
+struct Node *RTreeBulkLoadSTR(struct RTreeContext *c, struct Rect *rects,
+                              RTreeId *ids, RTreeId n) {
+  struct Branch *b;
+  struct Node *root;
+  int level = 0;
+
+  if (n <= 0)
+    return RTreeNewIndex(c);
+
+  b = RTreeLoadEntries(rects, ids, n);
+  do {
+    RTreeTileSTR(b, n, level > 0 ? NODECARD(c) : LEAFCARD(c));
+    n = RTreePackLevel(c, b, n, level++);
+  } while (n > 1);
+
+  root = b[0].child;
+  free(b);
+  return root;
+}
+
+// Build an index by packing the data rects in the order they are given,
+// at every level. The caller is responsible for a good (spatially coherent)
+// order, e.g. along a space filling curve for a Hilbert packed R-tree
+// (Kamel & Faloutsos, 1993). Same conventions as RTreeBulkLoadSTR.
+//
+struct Node *RTreeBulkLoadOrdered(struct RTreeContext *c, struct Rect *rects,
+                                  RTreeId *ids, RTreeId n) {
+  struct Branch *b;
+  struct Node *root;
+  int level = 0;
+
+  if (n <= 0)
+    return RTreeNewIndex(c);
+
+  b = RTreeLoadEntries(rects, ids, n);
+  do
+    n = RTreePackLevel(c, b, n, level++);
+  while (n > 1);
+
+  root = b[0].child;
+  free(b);
+  return root;
+}
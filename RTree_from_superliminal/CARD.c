@@ -2,8 +2,16 @@
 #include "Index.h"
 #include "CARD.H"
 
-int NODECARD = MAXCARD;
-int LEAFCARD = MAXCARD;
+// Default context: full nodes (MAXCARD) at every level, quadratic split,
+// no node allocated yet.
+void RTreeInitContext(struct RTreeContext *c)
+{
+	c->nodecard = MAXCARD;
+	c->leafcard = MAXCARD;
+	c->BranchCount = 0;
+	c->policy = &RTreeQuadraticPolicy;
+	RTreeInitArena(&c->arena, 0);
+}
 
 static int set_max(int *which, int new_max)
 {
@@ -13,7 +21,7 @@ static int set_max(int *which, int new_max)
 	return 1;
 }
 
-int RTreeSetNodeMax(int new_max) { return set_max(&NODECARD, new_max); }
-int RTreeSetLeafMax(int new_max) { return set_max(&LEAFCARD, new_max); }
-int RTreeGetNodeMax() { return NODECARD; }
-int RTreeGetLeafMax() { return LEAFCARD; }
+int RTreeSetNodeMax(struct RTreeContext *c, int new_max) { return set_max(&c->nodecard, new_max); }
+int RTreeSetLeafMax(struct RTreeContext *c, int new_max) { return set_max(&c->leafcard, new_max); }
+int RTreeGetNodeMax(const struct RTreeContext *c) { return NODECARD(c); }
+int RTreeGetLeafMax(const struct RTreeContext *c) { return LEAFCARD(c); }
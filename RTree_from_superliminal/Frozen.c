@@ -0,0 +1,278 @@
+#include "Index.h"
+#include "assert.h"
+#include <float.h>
+#include <stdint.h>
+#include <stdlib.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*-----------------------------------------------------------------------------
+| Frozen index: a read-only, pointer-free copy of a tree for query serving.
+| A built tree is a web of separately allocated struct Node linked by
+| pointers, with empty slots left in most nodes. Freezing copies it into a
+| single array of struct FrozenNode (see Index.h) in breadth-first or van
+| Emde Boas order, so that a query walks through a few nearby pages instead
+| of nodes scattered all over the heap.
+| The overlap test of a node is vectorized: with AVX (-mavx, -mavx2 or
+| -march=native, see RTREE_NATIVE in CMakeLists.txt) 8 branches are tested
+| per instruction, with SSE2 (any x86-64 build) 4, otherwise one at a time.
+-----------------------------------------------------------------------------*/
+
+// The overlap mask has one bit per lane
+typedef char RTreeFrozenLanesFitMask[(FROZEN_LANES <= 32) ? 1 : -1];
+
+// Node of the source tree and its position in the frozen array, sorted by
+// node address to translate child pointers into positions.
+struct FrozenSlot {
+  struct Node *node;
+  FrozenOffset pos;
+};
+
+static int RTreeCompareSlots(const void *A, const void *B) {
+  uintptr_t a = (uintptr_t)((const struct FrozenSlot *)A)->node;
+  uintptr_t b = (uintptr_t)((const struct FrozenSlot *)B)->node;
+  return (a > b) - (a < b);
+}
+
+static int RTreeCountNodes(struct Node *n) {
+  int i, count = 1;
+
+  if (n->level > 0)
+    for (i = 0; i < n->count; i++)
+      count += RTreeCountNodes(n->branch[i].child);
+  return count;
+}
+
+// Breadth-first order: the array itself is the queue.
+static void RTreeOrderBFS(struct Node *root, struct Node **order) {
+  int head, tail = 0, i;
+
+  order[tail++] = root;
+  for (head = 0; head < tail; head++) {
+    struct Node *n = order[head];
+    if (n->level > 0)
+      for (i = 0; i < n->count; i++)
+        order[tail++] = n->branch[i].child;
+  }
+}
+
+static void RTreeOrderVEB(struct Node *n, int height, struct Node **order,
+                          int *k);
+
+// Emits, in van Emde Boas order, the subtrees of the given height hanging
+// depth levels below n.
+static void RTreeOrderVEBBottoms(struct Node *n, int depth, int height,
+                                 struct Node **order, int *k) {
+  int i;
+
+  if (depth == 0) {
+    RTreeOrderVEB(n, height, order, k);
+    return;
+  }
+  for (i = 0; i < n->count; i++)
+    RTreeOrderVEBBottoms(n->branch[i].child, depth - 1, height, order, k);
+}
+
+// van Emde Boas order of the top height levels of the subtree of n: the top
+// half of the levels first, then every bottom subtree, each laid out the
+// same way recursively. Every group of levels of a query path then lies in
+// one small contiguous block, whatever the block (cache line, page) size.
+static void RTreeOrderVEB(struct Node *n, int height, struct Node **order,
+                          int *k) {
+  int top = height / 2;
+
+  if (height == 1) {
+    order[(*k)++] = n;
+    return;
+  }
+  RTreeOrderVEB(n, top, order, k);
+  RTreeOrderVEBBottoms(n, top, height - top, order, k);
+}
+
+// Copies the branches of n into fn: rects, count and level, and the data
+// IDs if n is a leaf (the children of an internal node are left to the
+// caller, which knows where they go).
+void RTreeFreezeNode(struct Node *n, struct FrozenNode *fn) {
+  int j, d;
+
+  fn->level = n->level;
+  fn->count = n->count;
+  for (j = 0; j < FROZEN_LANES; j++) {
+    // Padding: empty rects (min > max), never overlap a query
+    for (d = 0; d < NUMDIMS; d++) {
+      fn->min[d][j] = FLT_MAX;
+      fn->max[d][j] = -FLT_MAX;
+    }
+    fn->child[j] = 0;
+  }
+  for (j = 0; j < n->count; j++) {
+    struct Branch *b = &n->branch[j];
+    for (d = 0; d < NUMDIMS; d++) {
+      fn->min[d][j] = b->rect.boundary[d];
+      fn->max[d][j] = b->rect.boundary[d + NUMDIMS];
+    }
+    if (n->level == 0)
+      fn->child[j] = b->id;
+  }
+}
+
+// Copies the tree of root into one contiguous array, in the given order.
+// The source tree is left untouched (free it separately if not needed).
+// Returns 1 on success, 0 if out of memory.
+int RTreeFreeze(struct Node *root, enum RTreeFreezeLayout layout,
+                struct FrozenIndex *f) {
+  int count, i, j, k = 0;
+  struct Node **order;
+  struct FrozenSlot *slots;
+
+  assert(root);
+  assert(f);
+
+  count = RTreeCountNodes(root);
+  order = (struct Node **)malloc(count * sizeof(struct Node *));
+  slots = (struct FrozenSlot *)malloc(count * sizeof(struct FrozenSlot));
+  f->nodes = NULL;
+  f->nodeCount = count;
+  if (posix_memalign((void **)&f->nodes, 64,
+                     count * sizeof(struct FrozenNode)) != 0)
+    f->nodes = NULL;
+  if (!order || !slots || !f->nodes) {
+    free(order);
+    free(slots);
+    free(f->nodes);
+    f->nodes = NULL;
+    f->nodeCount = 0;
+    return 0;
+  }
+
+  if (layout == RTREE_FREEZE_VEB)
+    RTreeOrderVEB(root, root->level + 1, order, &k);
+  else
+    RTreeOrderBFS(root, order);
+
+  for (i = 0; i < count; i++) {
+    slots[i].node = order[i];
+    slots[i].pos = (FrozenOffset)i;
+  }
+  qsort(slots, count, sizeof(struct FrozenSlot), RTreeCompareSlots);
+
+  for (i = 0; i < count; i++) {
+    struct Node *n = order[i];
+    struct FrozenNode *fn = &f->nodes[i];
+
+    RTreeFreezeNode(n, fn);
+    if (n->level == 0)
+      continue;
+    for (j = 0; j < n->count; j++) {
+      struct FrozenSlot key, *hit;
+      key.node = n->branch[j].child;
+      hit = (struct FrozenSlot *)bsearch(&key, slots, count,
+                                         sizeof(struct FrozenSlot),
+                                         RTreeCompareSlots);
+      fn->child[j] = hit->pos;
+    }
+  }
+
+  free(order);
+  free(slots);
+  return 1;
+}
+
+// Bit i of the result is set if branch i of n overlaps r (same test as
+// RTreeOverlap, for all the branches of the node at once).
+unsigned int RTreeFrozenOverlapMask(const struct FrozenNode *n,
+                                    const struct Rect *r) {
+  unsigned int mask = 0;
+  int i, d;
+
+#if defined(__AVX__)
+  for (i = 0; i < FROZEN_LANES; i += 8) {
+    __m256 hit = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (d = 0; d < NUMDIMS; d++) {
+      __m256 lo = _mm256_set1_ps(r->boundary[d]);
+      __m256 hi = _mm256_set1_ps(r->boundary[d + NUMDIMS]);
+      hit = _mm256_and_ps(
+          hit, _mm256_cmp_ps(_mm256_load_ps(&n->min[d][i]), hi, _CMP_LE_OQ));
+      hit = _mm256_and_ps(
+          hit, _mm256_cmp_ps(lo, _mm256_load_ps(&n->max[d][i]), _CMP_LE_OQ));
+    }
+    mask |= (unsigned int)_mm256_movemask_ps(hit) << i;
+  }
+#elif defined(__SSE2__)
+  for (i = 0; i < FROZEN_LANES; i += 4) {
+    __m128 hit = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (d = 0; d < NUMDIMS; d++) {
+      __m128 lo = _mm_set1_ps(r->boundary[d]);
+      __m128 hi = _mm_set1_ps(r->boundary[d + NUMDIMS]);
+      hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_load_ps(&n->min[d][i]), hi));
+      hit = _mm_and_ps(hit, _mm_cmple_ps(lo, _mm_load_ps(&n->max[d][i])));
+    }
+    mask |= (unsigned int)_mm_movemask_ps(hit) << i;
+  }
+#else
+  for (i = 0; i < n->count; i++) {
+    int hit = 1;
+    for (d = 0; d < NUMDIMS; d++)
+      hit &= n->min[d][i] <= r->boundary[d + NUMDIMS] &&
+             r->boundary[d] <= n->max[d][i];
+    mask |= (unsigned int)hit << i;
+  }
+#endif
+  return mask;
+}
+
+// Index of the lowest set bit of a nonzero mask
+static int RTreeLowestBit(unsigned int mask) {
+#if defined(__GNUC__)
+  return __builtin_ctz(mask);
+#else
+  int i = 0;
+  while (!(mask & 1)) {
+    mask >>= 1;
+    i++;
+  }
+  return i;
+#endif
+}
+
+static int RTreeFrozenSearch2(const struct FrozenNode *nodes,
+                              const struct FrozenNode *n, struct Rect *r,
+                              SearchHitCallback shcb, void *cbarg) {
+  unsigned int mask = RTreeFrozenOverlapMask(n, r);
+  int hitCount = 0;
+  int i;
+
+  // Only the overlapping branches are visited, in branch order
+  for (; mask; mask &= mask - 1) {
+    i = RTreeLowestBit(mask);
+    if (n->level > 0) {
+      hitCount +=
+          RTreeFrozenSearch2(nodes, &nodes[n->child[i]], r, shcb, cbarg);
+    } else {
+      hitCount++;
+      if (shcb && !shcb(n->child[i], cbarg))
+        return hitCount; // callback wants to terminate search early
+    }
+  }
+  return hitCount;
+}
+
+// Same as RTreeSearch (same hits, same early termination), on a frozen
+// index. The branches of a node are tested together
+// (RTreeFrozenOverlapMask), and children are reached through their position
+// in the array.
+int RTreeFrozenSearch(const struct FrozenIndex *f, struct Rect *r,
+                      SearchHitCallback shcb, void *cbarg) {
+  assert(f && f->nodes);
+  assert(r);
+  return RTreeFrozenSearch2(f->nodes, &f->nodes[0], r, shcb, cbarg);
+}
+
+void RTreeFreeFrozen(struct FrozenIndex *f) {
+  free(f->nodes);
+  f->nodes = NULL;
+  f->nodeCount = 0;
+}
@@ -7,9 +7,9 @@
 
 // Make a new index, empty.  Consists of a single node.
 //
-struct Node *RTreeNewIndex() {
+struct Node *RTreeNewIndex(struct RTreeContext *c) {
   struct Node *x;
-  x = RTreeNewNode();
+  x = RTreeNewNode(c);
   x->level = 0; /* leaf */
   return x;
 }
@@ -43,29 +43,100 @@ int RTreeSearch(struct Node *N, struct Rect *R, SearchHitCallback shcb,
 
   if (n->level > 0) /* this is an internal node in the tree */
   {
-    for (i = 0; i < NODECARD; i++)
-      if (n->branch[i].child && RTreeOverlap(r, &n->branch[i].rect)) {
+    for (i = 0; i < n->count; i++) /* branches are packed at the front */
+      if (RTreeOverlap(r, &n->branch[i].rect)) {
         hitCount += RTreeSearch(n->branch[i].child, R, shcb, cbarg);
       }
   } else /* this is a leaf node */
   {
-    for (i = 0; i < LEAFCARD; i++)
-      if (n->branch[i].child && RTreeOverlap(r, &n->branch[i].rect)) {
+    for (i = 0; i < n->count; i++)
+      if (RTreeOverlap(r, &n->branch[i].rect)) {
         hitCount++;
         if (shcb) // call the user-provided callback
-          if (!shcb((int)(intptr_t)n->branch[i].child, cbarg))
-            // ed. the casting is quite interesting here.
-            // ed. in our case, we use the pointer child to store the int ID of
-            // a triangle.
-            // ed. was (int) before, changed to (int)(intptr_t) for portability
-            // to 64-bit systems.
+          if (!shcb(n->branch[i].id, cbarg))
+            // ed. in our case, the ID of a triangle (+1).
+            // ed. was a cast of the child pointer before, leaves now store
+            // the ID in the payload union of struct Branch.
             return hitCount; // callback wants to terminate search early
       }
   }
   return hitCount;
 }
 
-// Inserts a new data rectangle into the index structure.
+// Recursive walk of RTreeWindow, for trees too high for its stack: same
+// hits in the same order, counted from hitCount.
+static RTreeId RTreeWindow2(struct Node *n, struct Rect *r, RTreeId *ids,
+                            RTreeId capacity, RTreeId hitCount) {
+  int i;
+
+  for (i = 0; i < n->count; i++) {
+    if (!RTreeOverlap(r, &n->branch[i].rect))
+      continue;
+    if (n->level > 0) {
+      hitCount = RTreeWindow2(n->branch[i].child, r, ids, capacity, hitCount);
+      continue;
+    }
+    if (hitCount < capacity)
+      ids[hitCount] = n->branch[i].id;
+    hitCount++;
+  }
+  return hitCount;
+}
+
+// Walk of RTreeSearchWindow and RTreeCountWindow: stores the IDs of the
+// first capacity hits into ids (none if capacity is 0) and returns the
+// number of hits.
+static RTreeId RTreeWindow(struct Node *N, struct Rect *r, RTreeId *ids,
+                           RTreeId capacity) {
+  // Pending subtrees; a node pushes at most count - 1 more than it pops
+  struct Node *stack[RTREE_MAX_HEIGHT * MAXCARD];
+  RTreeId hitCount = 0;
+  int top = 0, i;
+
+  assert(N);
+  assert(r);
+  if (N->level >= RTREE_MAX_HEIGHT)
+    return RTreeWindow2(N, r, ids, capacity, 0);
+
+  stack[top++] = N;
+  while (top > 0) {
+    struct Node *n = stack[--top];
+
+    if (n->level > 0) {
+      // Pushed last to first: children are visited in the order of
+      // RTreeSearch, so are the hits
+      for (i = n->count - 1; i >= 0; i--)
+        if (RTreeOverlap(r, &n->branch[i].rect))
+          stack[top++] = n->branch[i].child;
+      continue;
+    }
+    for (i = 0; i < n->count; i++)
+      if (RTreeOverlap(r, &n->branch[i].rect)) {
+        if (hitCount < capacity)
+          ids[hitCount] = n->branch[i].id;
+        hitCount++;
+      }
+  }
+  return hitCount;
+}
+
+RTreeId RTreeSearchWindow(struct Node *N, struct Rect *R, RTreeId *ids,
+                          RTreeId capacity, RTreeId *needed) {
+  RTreeId hitCount;
+
+  assert(ids || capacity == 0);
+  hitCount = RTreeWindow(N, R, ids, capacity);
+  if (needed)
+    *needed = hitCount;
+  return hitCount < capacity ? hitCount : capacity;
+}
+
+RTreeId RTreeCountWindow(struct Node *N, struct Rect *R) {
+  return RTreeWindow(N, R, NULL, 0);
+}
+
+// Inserts a branch into the index structure: a data rectangle with its ID,
+// or a subtree.
 // Recursively descends tree, propagates splits back up.
 // Returns 0 if node was not split.  Old node updated.
 // If node was split, returns 1 and sets the pointer pointed to by
@@ -73,47 +144,38 @@ int RTreeSearch(struct Node *N, struct Rect *R, SearchHitCallback shcb,
 // The level argument specifies the number of steps up from the leaf
 // level to insert; e.g. a data rectangle goes in at level = 0.
 //
-static int RTreeInsertRect2(struct Rect *r, int tid, struct Node *n,
-                            struct Node **new_node, int level) {
-  /*
-          register struct Rect *r = R;
-          register int tid = Tid;
-          register struct Node *n = N, **new_node = New_node;
-          register int level = Level;
-  */
-
+static int RTreeInsertBranch2(struct RTreeContext *c, struct Branch *nb,
+                              struct Node *n, struct Node **new_node,
+                              int level) {
   register int i;
   struct Branch b;
   struct Node *n2;
 
-  assert(r && n && new_node);
+  assert(nb && n && new_node);
   assert(level >= 0 && level <= n->level);
 
   // Still above level for insertion, go down tree recursively
   //
   if (n->level > level) {
-    i = RTreePickBranch(r, n);
-    if (!RTreeInsertRect2(r, tid, n->branch[i].child, &n2, level)) {
+    i = c->policy->pickBranch(&nb->rect, n);
+    if (!RTreeInsertBranch2(c, nb, n->branch[i].child, &n2, level)) {
       // child was not split
       //
-      n->branch[i].rect = RTreeCombineRect(r, &(n->branch[i].rect));
+      n->branch[i].rect = RTreeCombineRect(&nb->rect, &(n->branch[i].rect));
       return 0;
     } else // child was split
     {
       n->branch[i].rect = RTreeNodeCover(n->branch[i].child);
       b.child = n2;
       b.rect = RTreeNodeCover(n2);
-      return RTreeAddBranch(&b, n, new_node);
+      return RTreeAddBranch(c, &b, n, new_node);
     }
   }
 
-  // Have reached level for insertion. Add rect, split if necessary
+  // Have reached level for insertion. Add branch, split if necessary
   //
   else if (n->level == level) {
-    b.rect = *r;
-    b.child = (struct Node *)(intptr_t)tid;
-    /* child field of leaves contains tid of data record */
-    return RTreeAddBranch(&b, n, new_node);
+    return RTreeAddBranch(c, nb, n, new_node);
   } else {
     /* Not supposed to happen */
     assert(FALSE);
@@ -121,16 +183,19 @@ static int RTreeInsertRect2(struct Rect *r, int tid, struct Node *n,
   }
 }
 
-// Insert a data rectangle into an index structure.
-// RTreeInsertRect provides for splitting the root;
+// Insert a branch into an index structure at the given level: a data
+// rectangle and its ID at level 0, or a subtree of that level.
+// RTreeInsertBranch provides for splitting the root;
 // returns 1 if root was split, 0 if it was not.
-// The level argument specifies the number of steps up from the leaf
-// level to insert; e.g. a data rectangle goes in at level = 0.
-// RTreeInsertRect2 does the recursion.
+// RTreeInsertBranch2 does the recursion.
+// The subtree choice and the split are those of the context policy.
 //
-int RTreeInsertRect(struct Rect *R, int Tid, struct Node **Root, int Level) {
-  register struct Rect *r = R;
-  register int tid = Tid;
+int RTreeInsertBranch(struct RTreeContext *c, struct Branch *B,
+                      struct Node **Root, int Level) {
+  if (c->policy->insertBranch) /* policy with its own insertion (R*) */
+    return c->policy->insertBranch(c, B, Root, Level);
+
+  register struct Branch *nb = B;
   register struct Node **root = Root;
   register int level = Level;
   register int i;
@@ -139,21 +204,21 @@ int RTreeInsertRect(struct Rect *R, int Tid, struct Node **Root, int Level) {
   struct Branch b;
   int result;
 
-  assert(r && root);
+  assert(c && nb && root);
   assert(level >= 0 && level <= (*root)->level);
   for (i = 0; i < NUMDIMS; i++)
-    assert(r->boundary[i] <= r->boundary[NUMDIMS + i]);
+    assert(nb->rect.boundary[i] <= nb->rect.boundary[NUMDIMS + i]);
 
-  if (RTreeInsertRect2(r, tid, *root, &newnode, level)) /* root split */
+  if (RTreeInsertBranch2(c, nb, *root, &newnode, level)) /* root split */
   {
-    newroot = RTreeNewNode(); /* grow a new root, & tree taller */
+    newroot = RTreeNewNode(c); /* grow a new root, & tree taller */
     newroot->level = (*root)->level + 1;
     b.rect = RTreeNodeCover(*root);
     b.child = *root;
-    RTreeAddBranch(&b, newroot, NULL);
+    RTreeAddBranch(c, &b, newroot, NULL);
     b.rect = RTreeNodeCover(newnode);
     b.child = newnode;
-    RTreeAddBranch(&b, newroot, NULL);
+    RTreeAddBranch(c, &b, newroot, NULL);
     *root = newroot;
     result = 1;
   } else
@@ -162,26 +227,49 @@ int RTreeInsertRect(struct Rect *R, int Tid, struct Node **Root, int Level) {
   return result;
 }
 
+// Insert a data rectangle into an index structure.
+// Tid is the ID of the data rect and MUST NEVER BE ZERO.
+// Returns 1 if root was split, 0 if it was not.
+// The level argument specifies the number of steps up from the leaf
+// level to insert; e.g. a data rectangle goes in at level = 0.
+//
+int RTreeInsertRect(struct RTreeContext *c, struct Rect *R, RTreeId Tid,
+                    struct Node **Root, int Level) {
+  struct Branch b;
+
+  assert(R);
+  b.rect = *R;
+  b.child = NULL; /* clears the whole payload when the ID is narrower */
+  b.id = Tid;
+  return RTreeInsertBranch(c, &b, Root, Level);
+}
+
 // Allocate space for a node in the list used in DeletRect to
 // store Nodes that are too empty.
 //
-static struct ListNode *RTreeNewListNode() {
-  return (struct ListNode *)malloc(sizeof(struct ListNode));
+static struct ListNode *RTreeNewListNode(struct RTreeContext *c) {
+  struct ListNode *l =
+      (struct ListNode *)RTreeArenaPop(&c->arena.freeListNodes);
+  if (!l)
+    l = (struct ListNode *)RTreeArenaAlloc(&c->arena,
+                                           sizeof(struct ListNode));
+  return l;
   // return new ListNode;
 }
 
-static void RTreeFreeListNode(struct ListNode *p) {
-  free(p);
+static void RTreeFreeListNode(struct RTreeContext *c, struct ListNode *p) {
+  RTreeArenaPush(&c->arena.freeListNodes, p);
   // delete(p);
 }
 
 // Add a node to the reinsertion list.  All its branches will later
 // be reinserted into the index structure.
 //
-static void RTreeReInsert(struct Node *n, struct ListNode **ee) {
+static void RTreeReInsert(struct RTreeContext *c, struct Node *n,
+                          struct ListNode **ee) {
   register struct ListNode *l;
 
-  l = RTreeNewListNode();
+  l = RTreeNewListNode(c);
   l->node = n;
   l->next = *ee;
   *ee = l;
@@ -192,10 +280,11 @@ static void RTreeReInsert(struct Node *n, struct ListNode **ee) {
 // merges branches on the way back up.
 // Returns 1 if record not found, 0 if success.
 //
-static int RTreeDeleteRect2(struct Rect *R, int Tid, struct Node *N,
+static int RTreeDeleteRect2(struct RTreeContext *c, struct Rect *R,
+                            RTreeId Tid, struct Node *N,
                             struct ListNode **Ee) {
   register struct Rect *r = R;
-  register int tid = Tid;
+  register RTreeId tid = Tid;
   register struct Node *n = N;
   register struct ListNode **ee = Ee;
   register int i;
@@ -206,16 +295,16 @@ static int RTreeDeleteRect2(struct Rect *R, int Tid, struct Node *N,
 
   if (n->level > 0) // not a leaf node
   {
-    for (i = 0; i < NODECARD; i++) {
-      if (n->branch[i].child && RTreeOverlap(r, &(n->branch[i].rect))) {
-        if (!RTreeDeleteRect2(r, tid, n->branch[i].child, ee)) {
-          if (n->branch[i].child->count >= MinNodeFill)
+    for (i = 0; i < n->count; i++) {
+      if (RTreeOverlap(r, &(n->branch[i].rect))) {
+        if (!RTreeDeleteRect2(c, r, tid, n->branch[i].child, ee)) {
+          if (n->branch[i].child->count >= MinNodeFill(c))
             n->branch[i].rect = RTreeNodeCover(n->branch[i].child);
           else {
             // not enough entries in child,
             // eliminate child node
             //
-            RTreeReInsert(n->branch[i].child, ee);
+            RTreeReInsert(c, n->branch[i].child, ee);
             RTreeDisconnectBranch(n, i);
           }
           return 0;
@@ -225,9 +314,8 @@ static int RTreeDeleteRect2(struct Rect *R, int Tid, struct Node *N,
     return 1;
   } else // a leaf node
   {
-    for (i = 0; i < LEAFCARD; i++) {
-      if (n->branch[i].child &&
-          n->branch[i].child == (struct Node *)(intptr_t)tid) {
+    for (i = 0; i < n->count; i++) {
+      if (n->branch[i].id == tid) {
         RTreeDisconnectBranch(n, i);
         return 0;
       }
@@ -241,48 +329,42 @@ static int RTreeDeleteRect2(struct Rect *R, int Tid, struct Node *N,
 // Returns 1 if record not found, 0 if success.
 // RTreeDeleteRect provides for eliminating the root.
 //
-int RTreeDeleteRect(struct Rect *R, int Tid, struct Node **Nn) {
+int RTreeDeleteRect(struct RTreeContext *c, struct Rect *R, RTreeId Tid,
+                    struct Node **Nn) {
   register struct Rect *r = R;
-  register int tid = Tid;
+  register RTreeId tid = Tid;
   register struct Node **nn = Nn;
   register int i;
   register struct Node *tmp_nptr;
   struct ListNode *reInsertList = NULL;
   register struct ListNode *e;
 
-  assert(r && nn);
+  assert(c && r && nn);
   assert(*nn);
   assert(tid >= 0);
 
-  if (!RTreeDeleteRect2(r, tid, *nn, &reInsertList)) {
+  if (!RTreeDeleteRect2(c, r, tid, *nn, &reInsertList)) {
     /* found and deleted a data item */
 
-    /* reinsert any branches from eliminated nodes */
+    /* reinsert any branches from eliminated nodes, data rects and
+       subtrees alike (the whole payload is copied, never truncated) */
     while (reInsertList) {
       tmp_nptr = reInsertList->node;
-      for (i = 0; i < MAXKIDS(tmp_nptr); i++) {
-        if (tmp_nptr->branch[i].child) {
-          RTreeInsertRect(&(tmp_nptr->branch[i].rect),
-                          (int)(intptr_t)tmp_nptr->branch[i].child, nn,
-                          tmp_nptr->level);
-        }
+      for (i = 0; i < tmp_nptr->count; i++) {
+        RTreeInsertBranch(c, &tmp_nptr->branch[i], nn, tmp_nptr->level);
       }
       e = reInsertList;
       reInsertList = reInsertList->next;
-      RTreeFreeNode(e->node);
-      RTreeFreeListNode(e);
+      RTreeFreeNode(c, e->node);
+      RTreeFreeListNode(c, e);
     }
 
     /* check for redundant root (not leaf, 1 child) and eliminate
      */
     if ((*nn)->count == 1 && (*nn)->level > 0) {
-      for (i = 0; i < NODECARD; i++) {
-        tmp_nptr = (*nn)->branch[i].child;
-        if (tmp_nptr)
-          break;
-      }
+      tmp_nptr = (*nn)->branch[0].child; /* the only branch */
       assert(tmp_nptr);
-      RTreeFreeNode(*nn);
+      RTreeFreeNode(c, *nn);
       *nn = tmp_nptr;
     }
     return 0;
@@ -1,6 +1,8 @@
 #ifndef _INDEX_
 #define _INDEX_
 
+#include <stddef.h>
+
 /* PGSIZE is normally the natural page size of the machine */
 #define PGSIZE	512
 #define NUMDIMS	2	/* number of dimensions */
@@ -35,11 +37,29 @@ struct Rect
 
 struct Node; 
 
+/*
+ * ID of a data rect, as stored in the leaves and passed to the search
+ * callbacks (MUST NEVER BE ZERO). Also the type of the counts of data rects
+ * (IDs go from 1 to the count in the mesh wrapper).
+ * 32-bit by default; build with RTREE_64BIT_IDS (see CMakeLists.txt) for
+ * more than 2^31 - 1 data rects. Either way an ID shares its slot with the
+ * child pointer (see struct Branch), so nodes keep the same size.
+ */
+#ifdef RTREE_64BIT_IDS
+typedef long long RTreeId;
+#else
+typedef int RTreeId;
+#endif
+
 struct Branch
 {
 	struct Rect rect; //ed. the rectangle that englobes all things below (child node and everything next) 
 	//ed. (called MBR : minimum bounding rectangle)
-	struct Node *child; //ed. pointer to the next node
+	union
+	{
+		struct Node *child; //ed. pointer to the next node (level > 0)
+		RTreeId id; /* ID of the data rect (leaf) */
+	};
 };
 
 /* max branching factor of a node */
@@ -58,13 +78,24 @@ That is called the max branching factor.
 
 struct Node
 {
-	int count;
+	int count; /* branches in use, always branch[0] to branch[count-1] */
 	int level; /* 0 is leaf, others positive */
 	struct Branch branch[MAXCARD]; //ed. array that store data
-	//ed. if a leaf, then points to the real data (for example an index of a mesh triangle, it would be casted to do so)
-	//ed. so if level > 0, just points to another node
+	//ed. if a leaf, then holds the ID of the real data (for example an index of a mesh triangle) in branch[i].id
+	//ed. so if level > 0, branch[i].child points to another node
 };
 
+/*
+ * Bound on the height of a tree (root level + 1) for the fixed-size
+ * per-level arrays: the explicit stacks of the iterative searches, the R*
+ * reinsertion bookkeeping, the levels of a quantized copy and the paths of
+ * the locate cursors. Non-root nodes are at least 40% full, so 32 levels
+ * hold more entries than any RTreeId can count; every user still checks the
+ * level of the root and falls back (recursive search, plain split) or
+ * fails on a higher tree rather than overflow.
+ */
+#define RTREE_MAX_HEIGHT 32
+
 struct ListNode
 {
 	struct ListNode *next;
@@ -77,6 +108,184 @@ To be more precise, when a node grows "too big" (over MAXCARD), then the R-Tree
 then temporarily stores some nodes somewhere to reinsert them later. It does so with ListNode.
 */
 
+/* variables for finding a partition (used while splitting a node) */
+#define METHODS 1
+
+struct PartitionVars
+{
+	int partition[MAXCARD+1];
+	int total, minfill;
+	int taken[MAXCARD+1];
+	int count[2];
+	struct Rect cover[2];
+	RectReal area[2];
+};
+
+/*
+ * Memory of the nodes of an index (see Arena.c): nodes are cut from large
+ * slabs, recycled through free lists, and all released at once by
+ * RTreeFreeIndex.
+ */
+struct RTreeArena
+{
+	void *slabs; /* newest slab, each one linked to the previous */
+	char *next, *end; /* free space left in the newest slab */
+	void *freeNodes; /* released nodes, reused first */
+	void *freeListNodes; /* same for the ListNode of RTreeDeleteRect */
+	int slabCount;
+	int hugePages; /* back the slabs by huge pages */
+};
+
+/*
+ * Per-index state for the routines that modify a tree.
+ * The cardinalities and the scratch buffers of the node split used to be
+ * process-wide globals (NODECARD, LEAFCARD, BranchBuf, ...), which made it
+ * impossible to insert into two trees from two threads at the same time.
+ * Each index (or each thread working on an index) now owns its context;
+ * read-only routines such as RTreeSearch do not need one.
+ * The context also owns the memory of the nodes, so the tree built with it
+ * lives until RTreeFreeIndex.
+ * Initialize with RTreeInitContext before use.
+ */
+struct RTreeContext
+{
+	int nodecard; /* max branching factor of internal nodes */
+	int leafcard; /* max branching factor of leaves */
+
+	/* split scratch: branches of the full node plus the extra one */
+	struct Branch BranchBuf[MAXCARD+1];
+	int BranchCount;
+	struct Rect CoverSplit;
+	RectReal CoverSplitArea;
+	struct PartitionVars Partitions[METHODS];
+
+	/* how to choose subtrees and split nodes, see struct RTreePolicy */
+	const struct RTreePolicy *policy;
+
+	/* where the nodes are allocated */
+	struct RTreeArena arena;
+};
+
+/*
+ * Insertion policy of an index: the subtree choice and the node split used
+ * by RTreeInsertRect and RTreeAddBranch. A policy can also bring its own
+ * insertion routine (R* does, for forced reinsertion); otherwise the
+ * generic one in Index.c is used. The routine inserts a whole branch at a
+ * given level, a data rect at level 0 or a subtree when RTreeDeleteRect
+ * reinserts the branches of an eliminated node. All policies produce regular trees that
+ * RTreeSearch can query. Policies are selected per context, so trees built
+ * with different policies coexist in one program (see RTreePolicies).
+ */
+struct RTreePolicy
+{
+	const char *name;
+	int (*pickBranch)(struct Rect *, struct Node *);
+	void (*splitNode)(struct RTreeContext *, struct Node *, struct Branch *, struct Node **);
+	int (*insertBranch)(struct RTreeContext *, struct Branch *, struct Node **, int); /* NULL for the generic one */
+};
+
+extern const struct RTreePolicy RTreeLinearPolicy;	/* Guttman, linear split (Split_l.c) */
+extern const struct RTreePolicy RTreeQuadraticPolicy;	/* Guttman, quadratic split (Split_q.c), default */
+extern const struct RTreePolicy RTreeRStarPolicy;	/* R*-tree (RStar.c) */
+
+/* NULL terminated list of all the policies */
+extern const struct RTreePolicy *const RTreePolicies[];
+
+/*
+ * Frozen (read-only) copy of an index, made by RTreeFreeze once the tree is
+ * built. All the nodes live in one contiguous array, children are referred
+ * to by their position in that array instead of a pointer, and the
+ * branches of every node are packed at the front (count of them, no empty
+ * slots to skip). Leaves keep the data ID in child, so child is an RTreeId
+ * (32 or 64 bits, see RTREE_64BIT_IDS) in all nodes.
+ * The branch rects are stored as structure of arrays, one array per side
+ * (xmin[], ymin[], xmax[], ymax[] in 2D), so that a query rect can be tested
+ * against all the branches of a node at once with SIMD compares
+ * (RTreeFrozenOverlapMask). Arrays are padded to FROZEN_LANES entries, the
+ * padding holds empty rects that overlap nothing.
+ * The tree cannot be modified; query it with RTreeFrozenSearch and release
+ * it with RTreeFreeFrozen. The root is nodes[0].
+ */
+typedef unsigned int FrozenOffset;
+
+/* MAXCARD rounded up to a whole number of 8-float (AVX) registers */
+#define FROZEN_LANES ((MAXCARD + 7) / 8 * 8)
+
+/* nodes start on a cache line, so that every array is register aligned */
+#if defined(__GNUC__)
+#define FROZEN_ALIGN __attribute__((aligned(64)))
+#else
+#define FROZEN_ALIGN
+#endif
+
+struct FrozenNode
+{
+	RectReal min[NUMDIMS][FROZEN_LANES]; /* boundary[d] of every branch */
+	RectReal max[NUMDIMS][FROZEN_LANES]; /* boundary[d + NUMDIMS] of every branch */
+	RTreeId child[FROZEN_LANES]; /* node position, or data ID in a leaf */
+	int count;
+	int level; /* 0 is leaf, others positive */
+} FROZEN_ALIGN;
+
+struct FrozenIndex
+{
+	struct FrozenNode *nodes;
+	int nodeCount;
+};
+
+/* order of the nodes in the frozen array */
+enum RTreeFreezeLayout
+{
+	RTREE_FREEZE_BFS,	/* breadth-first: level by level from the root */
+	RTREE_FREEZE_VEB	/* van Emde Boas: recursive top/bottom halves of the height */
+};
+
+/*
+ * Quantized (read-only) copy of an index, made by RTreeQuantize. The leaves
+ * are those of the source tree, with exact float rects, stored as in a
+ * frozen index. Above them, internal nodes store the rects of their children
+ * as QuantCoord grid coordinates relative to their own MBR (origin and cell
+ * size per dimension), rounded outward so that a quantized rect always
+ * contains the exact one. A child then takes 12 bytes instead of the 24 of a
+ * struct Branch (8 with RTREE_QUANT_BITS=8), which widens the
+ * internal nodes (QUANTCARD) and makes the tree lower. Queries are exact:
+ * quantization only lets a few more branches be visited.
+ * Query with RTreeQuantSearch, release with RTreeFreeQuantized.
+ */
+#ifndef RTREE_QUANT_BITS
+#define RTREE_QUANT_BITS 16	/* 8 or 16 */
+#endif
+#if RTREE_QUANT_BITS == 8
+typedef unsigned char QuantCoord;
+#else
+typedef unsigned short QuantCoord;
+#endif
+#define QUANT_MAX ((1 << RTREE_QUANT_BITS) - 1)
+
+/* max branching factor of a quantized node, which also fits in PGSIZE */
+#define QUANTCARD (int)((PGSIZE-(2*sizeof(int))-(2*NUMDIMS*sizeof(RectReal))) / \
+	(2*NUMDIMS*sizeof(QuantCoord)+sizeof(FrozenOffset)))
+
+struct QuantNode
+{
+	int count;
+	int level; /* 1 above the leaves, others higher */
+	RectReal origin[NUMDIMS]; /* low corner of the node MBR */
+	RectReal scale[NUMDIMS]; /* size of a grid cell */
+	QuantCoord min[NUMDIMS][QUANTCARD];
+	QuantCoord max[NUMDIMS][QUANTCARD];
+	FrozenOffset child[QUANTCARD]; /* position in nodes, or in leaves at level 1 */
+};
+
+struct QuantIndex
+{
+	struct QuantNode *nodes; /* internal nodes, root first (none if one leaf) */
+	int nodeCount;
+	struct FrozenNode *leaves;
+	int leafCount;
+	int height; /* levels, leaves included */
+};
+
 /*
  * If passed to a tree search, this callback function will be called
  * with the ID of each data rect that overlaps the search rect
@@ -84,16 +293,43 @@ then temporarily stores some nodes somewhere to reinsert them later. It does so
  * It can terminate the search early by returning 0 in which case
  * the search will return the number of hits found up to that point.
  */
-typedef int (*SearchHitCallback)(int id, void* arg);
+typedef int (*SearchHitCallback)(RTreeId id, void* arg);
 
 
 extern int RTreeSearch(struct Node*, struct Rect*, SearchHitCallback, void*);
-extern int RTreeInsertRect(struct Rect*, int, struct Node**, int depth);
-extern int RTreeDeleteRect(struct Rect*, int, struct Node**);
-extern struct Node * RTreeNewIndex();
-extern struct Node * RTreeNewNode();
+
+/*
+ * Window queries without callback: the same hits as RTreeSearch, in the
+ * same order, found by an iterative walk with a fixed-size stack (trees up
+ * to RTREE_MAX_HEIGHT levels, recursive above) and no allocation.
+ * RTreeSearchWindow writes the IDs of the first capacity hits into ids and
+ * returns how many it wrote; the total number of hits goes to *needed (if
+ * not NULL), larger than capacity when the buffer was too small.
+ * RTreeCountWindow only returns the number of hits.
+ */
+extern RTreeId RTreeSearchWindow(struct Node*, struct Rect*, RTreeId*, RTreeId, RTreeId*);
+extern RTreeId RTreeCountWindow(struct Node*, struct Rect*);
+
+/*
+ * Spatial join (Join.c): a pair of overlapping data rects, one from each
+ * tree, by their IDs.
+ */
+struct RTreePair
+{
+	RTreeId a; /* ID in the first tree */
+	RTreeId b; /* ID in the second tree */
+};
+extern RTreeId RTreeJoin(struct Node*, struct Node*, struct RTreePair*, RTreeId, RTreeId*);
+extern RTreeId RTreeJoinGrow(struct Node*, struct Node*, struct RTreePair**, RTreeId*);
+
+extern int RTreeInsertRect(struct RTreeContext*, struct Rect*, RTreeId, struct Node**, int depth);
+extern int RTreeInsertBranch(struct RTreeContext*, struct Branch*, struct Node**, int depth);
+extern int RTreeDeleteRect(struct RTreeContext*, struct Rect*, RTreeId, struct Node**);
+extern struct Node * RTreeNewIndex(struct RTreeContext *);
+extern struct Node * RTreeNewNode(struct RTreeContext *);
 extern void RTreeInitNode(struct Node*);
-extern void RTreeFreeNode(struct Node *);
+extern void RTreeFreeNode(struct RTreeContext *, struct Node *);
+extern void RTreeFreeIndex(struct RTreeContext *);
 extern void RTreePrintNode(struct Node *, int);
 extern void RTreeTabIn(int);
 extern struct Rect RTreeNodeCover(struct Node *);
@@ -105,14 +341,45 @@ extern RectReal RTreeRectVolume(struct Rect *R);
 extern struct Rect RTreeCombineRect(struct Rect*, struct Rect*);
 extern int RTreeOverlap(struct Rect*, struct Rect*);
 extern void RTreePrintRect(struct Rect*, int);
-extern int RTreeAddBranch(struct Branch *, struct Node *, struct Node **);
+extern int RTreeAddBranch(struct RTreeContext *, struct Branch *, struct Node *, struct Node **);
 extern int RTreePickBranch(struct Rect *, struct Node *);
 extern void RTreeDisconnectBranch(struct Node *, int);
-extern void RTreeSplitNode(struct Node*, struct Branch*, struct Node**);
+extern void RTreeSplitNode(struct RTreeContext*, struct Node*, struct Branch*, struct Node**);
+extern void RTreeSplitNodeLinear(struct RTreeContext*, struct Node*, struct Branch*, struct Node**);
+extern void RTreeSplitNodeQuadratic(struct RTreeContext*, struct Node*, struct Branch*, struct Node**);
+
+extern int RTreeInsertBranchRStar(struct RTreeContext*, struct Branch*, struct Node**, int depth);
+extern int RTreePickBranchRStar(struct Rect *, struct Node *);
+extern void RTreeSplitNodeRStar(struct RTreeContext*, struct Node*, struct Branch*, struct Node**);
+
+extern struct Node * RTreeBulkLoadSTR(struct RTreeContext *, struct Rect *, RTreeId *, RTreeId);
+extern struct Node * RTreeBulkLoadOrdered(struct RTreeContext *, struct Rect *, RTreeId *, RTreeId);
+extern void RTreeTileSTR(struct Branch *, RTreeId, int);
+extern RTreeId RTreePackLevel(struct RTreeContext *, struct Branch *, RTreeId, int);
+
+extern int RTreeFreeze(struct Node *, enum RTreeFreezeLayout, struct FrozenIndex *);
+extern unsigned int RTreeFrozenOverlapMask(const struct FrozenNode *, const struct Rect *);
+extern void RTreeFreezeNode(struct Node *, struct FrozenNode *);
+extern int RTreeFrozenSearch(const struct FrozenIndex *, struct Rect *, SearchHitCallback, void *);
+extern void RTreeFreeFrozen(struct FrozenIndex *);
+
+extern int RTreeQuantize(struct Node *, struct QuantIndex *);
+extern int RTreeQuantSearch(const struct QuantIndex *, struct Rect *, SearchHitCallback, void *, int *);
+extern void RTreeFreeQuantized(struct QuantIndex *);
+
+extern void RTreeInitContext(struct RTreeContext *);
+extern void RTreeSetPolicy(struct RTreeContext *, const struct RTreePolicy *);
+extern const struct RTreePolicy * RTreeFindPolicy(const char *);
+extern int RTreeSetNodeMax(struct RTreeContext *, int);
+extern int RTreeSetLeafMax(struct RTreeContext *, int);
+extern int RTreeGetNodeMax(const struct RTreeContext *);
+extern int RTreeGetLeafMax(const struct RTreeContext *);
+extern void RTreeSetHugePages(struct RTreeContext *, int);
 
-extern int RTreeSetNodeMax(int);
-extern int RTreeSetLeafMax(int);
-extern int RTreeGetNodeMax();
-extern int RTreeGetLeafMax();
+extern void RTreeInitArena(struct RTreeArena *, int);
+extern void * RTreeArenaAlloc(struct RTreeArena *, size_t);
+extern void RTreeArenaPush(void **, void *);
+extern void * RTreeArenaPop(void **);
+extern void RTreeArenaMerge(struct RTreeArena *, struct RTreeArena *);
 
 #endif /* _INDEX_ */
@@ -0,0 +1,166 @@
+#include "Index.h"
+#include "assert.h"
+#include <stdlib.h>
+
+/*-----------------------------------------------------------------------------
+| Spatial join of two trees: every pair of data rects, one from each tree,
+| that overlap. Both trees are walked together, from the pair of roots down:
+| only the pairs of branches that overlap are followed, so the upper levels
+| are visited once instead of once per data rect of the other tree.
+| A pair of nodes is joined within the intersection of their rects: branches
+| outside of it cannot overlap anything in the other node and are dropped
+| before the pairs are formed.
+-----------------------------------------------------------------------------*/
+
+struct RTreeJoinState {
+  struct RTreePair *pairs;
+  RTreeId capacity;
+  RTreeId count;
+  int grow;   // Realloc pairs when full (RTreeJoinGrow)
+  int failed; // Out of memory while growing
+};
+
+// Pairs of the first buffer of RTreeJoinGrow, then doubled
+#define JOIN_INITIAL_PAIRS 256
+
+// Intersection of two overlapping rects
+static struct Rect RTreeIntersectRect(struct Rect *a, struct Rect *b) {
+  struct Rect r;
+  int d;
+
+  for (d = 0; d < NUMDIMS; d++) {
+    r.boundary[d] = a->boundary[d] > b->boundary[d] ? a->boundary[d]
+                                                    : b->boundary[d];
+    r.boundary[d + NUMDIMS] =
+        a->boundary[d + NUMDIMS] < b->boundary[d + NUMDIMS]
+            ? a->boundary[d + NUMDIMS]
+            : b->boundary[d + NUMDIMS];
+  }
+  return r;
+}
+
+// Branches of n overlapping window, by index
+static int RTreeJoinCandidates(struct Node *n, struct Rect *window,
+                               int *index) {
+  int i, k = 0;
+
+  for (i = 0; i < n->count; i++)
+    if (RTreeOverlap(window, &n->branch[i].rect))
+      index[k++] = i;
+  return k;
+}
+
+static void RTreeJoin2(struct Node *a, struct Rect *ra, struct Node *b,
+                       struct Rect *rb, struct RTreeJoinState *s);
+
+// Overlapping branches x and y of two nodes of the given level: joins their
+// subtrees, or emits the pair of IDs at the leaves
+static void RTreeJoinBranches(int level, struct Branch *x, struct Branch *y,
+                              struct RTreeJoinState *s) {
+  if (level > 0) {
+    RTreeJoin2(x->child, &x->rect, y->child, &y->rect, s);
+    return;
+  }
+  if (s->count == s->capacity && s->grow && !s->failed) {
+    RTreeId capacity = s->capacity ? 2 * s->capacity : JOIN_INITIAL_PAIRS;
+    struct RTreePair *pairs = (struct RTreePair *)realloc(
+        s->pairs, capacity * sizeof(struct RTreePair));
+    if (pairs) {
+      s->pairs = pairs;
+      s->capacity = capacity;
+    } else {
+      s->failed = 1;
+    }
+  }
+  if (s->count < s->capacity) {
+    s->pairs[s->count].a = x->id;
+    s->pairs[s->count].b = y->id;
+  }
+  s->count++;
+}
+
+// Joins the subtrees of a and b, whose rects are ra and rb (overlapping).
+// The higher node goes down alone until both are at the same level.
+static void RTreeJoin2(struct Node *a, struct Rect *ra, struct Node *b,
+                       struct Rect *rb, struct RTreeJoinState *s) {
+  struct Rect window = RTreeIntersectRect(ra, rb);
+  int ia[MAXCARD], ib[MAXCARD];
+  int na, nb, i, j;
+
+  if (a->level > b->level) {
+    na = RTreeJoinCandidates(a, &window, ia);
+    for (i = 0; i < na; i++)
+      RTreeJoin2(a->branch[ia[i]].child, &a->branch[ia[i]].rect, b, rb, s);
+    return;
+  }
+  if (b->level > a->level) {
+    nb = RTreeJoinCandidates(b, &window, ib);
+    for (j = 0; j < nb; j++)
+      RTreeJoin2(a, ra, b->branch[ib[j]].child, &b->branch[ib[j]].rect, s);
+    return;
+  }
+
+  na = RTreeJoinCandidates(a, &window, ia);
+  nb = RTreeJoinCandidates(b, &window, ib);
+  for (i = 0; i < na; i++)
+    for (j = 0; j < nb; j++)
+      if (RTreeOverlap(&a->branch[ia[i]].rect, &b->branch[ib[j]].rect))
+        RTreeJoinBranches(a->level, &a->branch[ia[i]], &b->branch[ib[j]], s);
+}
+
+// Writes the first capacity pairs of overlapping data rects of the trees of
+// A and B into pairs (ID in A, ID in B) and returns how many it wrote; the
+// total number of pairs goes to *needed (if not NULL). Pairs come in the
+// order of the branches of A, then of B, at each level: joining the pairs
+// of subtrees under the roots one after the other gives the same list.
+static void RTreeJoinRoots(struct Node *A, struct Node *B,
+                           struct RTreeJoinState *s) {
+  struct Rect ra, rb;
+
+  assert(A && B);
+  if (A->count > 0 && B->count > 0) {
+    ra = RTreeNodeCover(A);
+    rb = RTreeNodeCover(B);
+    if (RTreeOverlap(&ra, &rb))
+      RTreeJoin2(A, &ra, B, &rb, s);
+  }
+}
+
+RTreeId RTreeJoin(struct Node *A, struct Node *B, struct RTreePair *pairs,
+                  RTreeId capacity, RTreeId *needed) {
+  struct RTreeJoinState s;
+
+  assert(pairs || capacity == 0);
+
+  s.pairs = pairs;
+  s.capacity = capacity;
+  s.count = 0;
+  s.grow = 0;
+  s.failed = 0;
+  RTreeJoinRoots(A, B, &s);
+  if (needed)
+    *needed = s.count;
+  return s.count < capacity ? s.count : capacity;
+}
+
+// Same pairs in a buffer grown during the one traversal: *pairs is a
+// malloc'ed buffer of *capacity pairs (NULL and 0 to start without one),
+// realloc'ed when full. Returns the number of pairs, all in *pairs, or -1
+// if out of memory; the caller frees *pairs in both cases.
+RTreeId RTreeJoinGrow(struct Node *A, struct Node *B, struct RTreePair **pairs,
+                      RTreeId *capacity) {
+  struct RTreeJoinState s;
+
+  assert(pairs && capacity);
+  assert(*pairs || *capacity == 0);
+
+  s.pairs = *pairs;
+  s.capacity = *capacity;
+  s.count = 0;
+  s.grow = 1;
+  s.failed = 0;
+  RTreeJoinRoots(A, B, &s);
+  *pairs = s.pairs;
+  *capacity = s.capacity;
+  return s.failed ? -1 : s.count;
+}
@@ -2,7 +2,6 @@
 #include "CARD.H"
 #include "Index.h"
 #include "assert.h"
-#include <malloc.h>
 #include <stdio.h>
 
 // Initialize one branch cell in a node.
@@ -30,21 +29,24 @@ void RTreeInitNode(struct Node *N) {
 }
 
 // Make a new node and initialize to have all branch cells empty.
+// The node comes from the arena of the context (a released node if any).
 //
-struct Node *RTreeNewNode() {
+struct Node *RTreeNewNode(struct RTreeContext *c) {
   register struct Node *n;
 
-  // n = new Node;
-  n = (struct Node *)malloc(sizeof(struct Node));
+  n = (struct Node *)RTreeArenaPop(&c->arena.freeNodes);
+  if (!n)
+    n = (struct Node *)RTreeArenaAlloc(&c->arena, sizeof(struct Node));
   assert(n);
   RTreeInitNode(n);
   return n;
 }
 
-void RTreeFreeNode(struct Node *p) {
+// Give a node back to the arena of the context, for reuse by RTreeNewNode.
+// Its memory is only released by RTreeFreeIndex.
+void RTreeFreeNode(struct RTreeContext *c, struct Node *p) {
   assert(p);
-  // delete p;
-  free(p);
+  RTreeArenaPush(&c->arena.freeNodes, p);
 }
 
 static void RTreePrintBranch(struct Branch *b, int depth) {
@@ -109,21 +111,17 @@ struct Rect RTreeNodeCover(struct Node *N) {
   assert(n);
 
   RTreeInitRect(&r);
-  for (i = 0; i < MAXKIDS(n); i++) // ed. and not MAXCARD
-    // ed. intuition : it can have the same value as MAXCARD (see NODECARD and
-    // LEAFCARD in card.h,.c), depending of if we are in a leaf or not ed. so
-    // that function would still work even if we change the size of the leafs
-    // without changing the size of the internal nodes
-    if (n->branch[i].child) {
-      if (first_time) // ed. first valid rectangle we found (r becomes that
-                      // rectangle)
-      {
-        r = n->branch[i].rect;
-        first_time = 0;
-      } else // ed. not the first, we need to make r bigger to include that new
-             // rectangle
-        r = RTreeCombineRect(&r, &(n->branch[i].rect));
-    }
+  for (i = 0; i < n->count; i++) // ed. branches are packed at the front
+  {
+    if (first_time) // ed. first valid rectangle we found (r becomes that
+                    // rectangle)
+    {
+      r = n->branch[i].rect;
+      first_time = 0;
+    } else // ed. not the first, we need to make r bigger to include that new
+           // rectangle
+      r = RTreeCombineRect(&r, &(n->branch[i].rect));
+  }
   return r;
 }
 
@@ -145,34 +143,31 @@ int RTreePickBranch(struct Rect *R, struct Node *N) {
   struct Rect tmp_rect;
   assert(r && n);
 
-  for (i = 0; i < MAXKIDS(n);
+  for (i = 0; i < n->count;
        i++) // ed. we want to loop on all children (all branches) of the node
   {
-    if (n->branch[i].child) // ed. if branch exists
+    rr = &n->branch[i].rect;             // ed. "current mbr of the child"
+    area = RTreeRectSphericalVolume(rr); // ed. cf. sphvol.c, current area
+    tmp_rect = RTreeCombineRect(
+        r, rr); // ed. what would be the mbr if we combine it with new rect r
+    increase = RTreeRectSphericalVolume(&tmp_rect) -
+               area; // ed. the difference of area between the combination and
+                     // the original
+    if (increase < bestIncr ||
+        first_time) // ed. best candidate that leads to the least increase yet
     {
-      rr = &n->branch[i].rect;             // ed. "current mbr of the child"
-      area = RTreeRectSphericalVolume(rr); // ed. cf. sphvol.c, current area
-      tmp_rect = RTreeCombineRect(
-          r, rr); // ed. what would be the mbr if we combine it with new rect r
-      increase = RTreeRectSphericalVolume(&tmp_rect) -
-                 area; // ed. the difference of area between the combination and
-                       // the original
-      if (increase < bestIncr ||
-          first_time) // ed. best candidate that leads to the least increase yet
-      {
-        best = i;
-        bestArea = area;
-        bestIncr = increase;
-        first_time = 0;
-      } else if (increase == bestIncr &&
-                 area < bestArea) // ed. special case, if we have the same
-                                  // increase (for two branches then) we just
-                                  // choose the smallest branch
-      {
-        best = i;
-        bestArea = area;
-        bestIncr = increase;
-      }
+      best = i;
+      bestArea = area;
+      bestIncr = increase;
+      first_time = 0;
+    } else if (increase == bestIncr &&
+               area < bestArea) // ed. special case, if we have the same
+                                // increase (for two branches then) we just
+                                // choose the smallest branch
+    {
+      best = i;
+      bestArea = area;
+      bestIncr = increase;
     }
   }
   return best;
@@ -183,41 +178,38 @@ int RTreePickBranch(struct Rect *R, struct Node *N) {
 // Returns 1 if node split, sets *new_node to address of new node.
 // Old node updated, becomes one of two.
 //
-int RTreeAddBranch(struct Branch *B, struct Node *N, struct Node **New_node) {
+int RTreeAddBranch(struct RTreeContext *c, struct Branch *B, struct Node *N,
+                   struct Node **New_node) {
   register struct Branch *b = B;
   register struct Node *n = N;
   register struct Node **new_node = New_node;
-  register int i;
 
   assert(b);
   assert(n);
 
-  if (n->count < MAXKIDS(n)) /* split won't be necessary */
+  if (n->count < MAXKIDS(c, n)) /* split won't be necessary */
   {
-    for (i = 0; i < MAXKIDS(n); i++) /* find empty branch */
-    {
-      if (n->branch[i].child == NULL) {
-        n->branch[i] = *b;
-        n->count++;
-        break;
-      }
-    }
+    n->branch[n->count++] = *b; /* first empty branch, they are packed */
     return 0;
   } else {
     assert(new_node);
-    RTreeSplitNode(n, b,
-                   new_node); // ed. cf. either the quadratic algorithm (in
-                              // split_q.c) or the linear (in split_l.c)
+    RTreeSplitNode(c, n, b,
+                   new_node); // ed. cf. the policy of the context: the
+                              // quadratic algorithm (in split_q.c), the
+                              // linear (in split_l.c) or R* (in RStar.c)
     return 1;
   }
 }
 
 // Disconnect a dependent node.
+// The last branch takes its place, so that the branches of a node always
+// are the first count ones and loops can stop at n->count.
 //
 void RTreeDisconnectBranch(struct Node *n, int i) {
-  assert(n && i >= 0 && i < MAXKIDS(n));
+  assert(n && i >= 0 && i < n->count);
   assert(n->branch[i].child);
 
-  RTreeInitBranch(&(n->branch[i]));
   n->count--;
+  n->branch[i] = n->branch[n->count];
+  RTreeInitBranch(&(n->branch[n->count]));
 }
@@ -0,0 +1,44 @@
+#include "Index.h"
+#include <string.h>
+
+/*-----------------------------------------------------------------------------
+| Registry of the insertion policies (subtree choice + node split).
+| To add a strategy, define its policy here and list it in RTreePolicies.
+-----------------------------------------------------------------------------*/
+
+const struct RTreePolicy RTreeLinearPolicy = {
+    "linear", RTreePickBranch, RTreeSplitNodeLinear, NULL};
+
+const struct RTreePolicy RTreeQuadraticPolicy = {
+    "quadratic", RTreePickBranch, RTreeSplitNodeQuadratic, NULL};
+
+const struct RTreePolicy RTreeRStarPolicy = {
+    "rstar", RTreePickBranchRStar, RTreeSplitNodeRStar, RTreeInsertBranchRStar};
+
+const struct RTreePolicy *const RTreePolicies[] = {
+    &RTreeLinearPolicy, &RTreeQuadraticPolicy, &RTreeRStarPolicy, NULL};
+
+// Select the policy used by the later inserts and deletes of an index.
+// Changing it on a non empty tree is allowed, all policies build valid trees.
+//
+void RTreeSetPolicy(struct RTreeContext *c, const struct RTreePolicy *policy) {
+  c->policy = policy;
+}
+
+// Find a registered policy by name, NULL if there is none.
+//
+const struct RTreePolicy *RTreeFindPolicy(const char *name) {
+  int i;
+  for (i = 0; RTreePolicies[i]; i++)
+    if (strcmp(RTreePolicies[i]->name, name) == 0)
+      return RTreePolicies[i];
+  return NULL;
+}
+
+// Split a node with the split of the context policy.
+// Called by RTreeAddBranch when the node is full.
+//
+void RTreeSplitNode(struct RTreeContext *c, struct Node *n, struct Branch *b,
+                    struct Node **nn) {
+  c->policy->splitNode(c, n, b, nn);
+}
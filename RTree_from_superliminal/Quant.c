@@ -0,0 +1,230 @@
+#include "Index.h"
+#include "assert.h"
+#include <math.h>
+#include <stdlib.h>
+
+/*-----------------------------------------------------------------------------
+| Quantized index: exact leaves under wide internal nodes with compressed
+| child rects (see struct QuantNode in Index.h).
+| The leaves of the source tree are kept, and the internal levels are packed
+| again above them with QUANTCARD children per node instead of NODECARD.
+| The source tree is left untouched.
+-----------------------------------------------------------------------------*/
+
+// Position of x on the grid of a node, in cells from its origin.
+// Children and queries go through this same computation, so that the
+// rounding never reorders two values and the quantized test never misses.
+static double RTreeQuantRatio(RectReal x, RectReal origin, RectReal scale) {
+  return ((double)x - origin) / scale;
+}
+
+static int RTreeQuantClamp(double v) {
+  if (v < 0)
+    return 0;
+  if (v > QUANT_MAX)
+    return QUANT_MAX;
+  return (int)v;
+}
+
+static int RTreeCountLeaves(struct Node *n) {
+  int i, count = 0;
+
+  if (n->level == 0)
+    return 1;
+  for (i = 0; i < n->count; i++)
+    count += RTreeCountLeaves(n->branch[i].child);
+  return count;
+}
+
+// Lists the leaves under n, with their covers.
+static void RTreeCollectLeaves(struct Node *n, struct Branch *b, int *k) {
+  int i;
+
+  if (n->level == 0) {
+    b[*k].rect = RTreeNodeCover(n);
+    b[(*k)++].child = n;
+    return;
+  }
+  for (i = 0; i < n->count; i++)
+    RTreeCollectLeaves(n->branch[i].child, b, k);
+}
+
+// Fills the quantized node qn with count children, whose exact rects and
+// positions (in the id of the branch) are in b. Returns the cover of the node.
+static struct Rect RTreeQuantizeNode(struct QuantNode *qn, int level,
+                                     struct Branch *b, int count) {
+  struct Rect cover = b[0].rect;
+  int i, d;
+
+  for (i = 1; i < count; i++)
+    cover = RTreeCombineRect(&cover, &b[i].rect);
+
+  qn->count = count;
+  qn->level = level;
+  for (d = 0; d < NUMDIMS; d++) {
+    RectReal extent = cover.boundary[d + NUMDIMS] - cover.boundary[d];
+    qn->origin[d] = cover.boundary[d];
+    qn->scale[d] = extent > 0 ? extent / QUANT_MAX : 1;
+  }
+  for (i = 0; i < count; i++) {
+    for (d = 0; d < NUMDIMS; d++) { // rounded outward
+      qn->min[d][i] = (QuantCoord)RTreeQuantClamp(floor(RTreeQuantRatio(
+          b[i].rect.boundary[d], qn->origin[d], qn->scale[d])));
+      qn->max[d][i] = (QuantCoord)RTreeQuantClamp(ceil(RTreeQuantRatio(
+          b[i].rect.boundary[d + NUMDIMS], qn->origin[d], qn->scale[d])));
+    }
+    qn->child[i] = (FrozenOffset)b[i].id;
+  }
+  return cover;
+}
+
+// Builds the quantized copy of the tree of root.
+// Every level (the leaves, then each internal level) is laid out again in
+// Sort-Tile-Recursive order for the wide nodes above it: grouping the
+// source leaves in their depth-first order would make the new nodes cross
+// the boundaries of the old ones and overlap a lot.
+// Returns 1 on success, 0 if out of memory (or if the copy would have more
+// than RTREE_MAX_HEIGHT levels).
+int RTreeQuantize(struct Node *root, struct QuantIndex *q) {
+  int levelCount[RTREE_MAX_HEIGHT], levelStart[RTREE_MAX_HEIGHT];
+  int levels = 0, total = 0, n, l, i;
+  struct Branch *b;
+
+  assert(root);
+  assert(q);
+
+  // Sizes of the internal levels, all nodes full but the last of a level
+  q->nodes = NULL;
+  q->leaves = NULL;
+  n = RTreeCountLeaves(root);
+  q->leafCount = n;
+  while (n > 1) {
+    if (levels == RTREE_MAX_HEIGHT - 1)
+      return 0;
+    n = (n + QUANTCARD - 1) / QUANTCARD;
+    levelCount[levels++] = n;
+    total += n;
+  }
+  q->height = levels + 1;
+  q->nodeCount = total;
+  b = (struct Branch *)malloc(q->leafCount * sizeof(struct Branch));
+  if (posix_memalign((void **)&q->leaves, 64,
+                     q->leafCount * sizeof(struct FrozenNode)) != 0)
+    q->leaves = NULL;
+  if (total > 0)
+    q->nodes = (struct QuantNode *)malloc(total * sizeof(struct QuantNode));
+  if (!b || !q->leaves || (total > 0 && !q->nodes)) {
+    free(b);
+    RTreeFreeQuantized(q);
+    return 0;
+  }
+
+  // Leaves, stored in the order of their parents to come
+  n = 0;
+  RTreeCollectLeaves(root, b, &n);
+  RTreeTileSTR(b, n, QUANTCARD);
+  for (i = 0; i < n; i++) {
+    RTreeFreezeNode(b[i].child, &q->leaves[i]);
+    b[i].id = i;
+  }
+
+  // Root first: the top level starts at 0, each level after the one above
+  for (l = levels - 1, i = 0; l >= 0; l--) {
+    levelStart[l] = i;
+    i += levelCount[l];
+  }
+
+  // Bottom up; the covers of a level replace the entries of the level below
+  for (l = 0; l < levels; l++) {
+    if (l > 0)
+      RTreeTileSTR(b, n, QUANTCARD);
+    for (i = 0; i < levelCount[l]; i++) {
+      int first = i * QUANTCARD;
+      int take = n - first < QUANTCARD ? n - first : QUANTCARD;
+      int pos = levelStart[l] + i;
+      struct Rect cover =
+          RTreeQuantizeNode(&q->nodes[pos], l + 1, b + first, take);
+      b[i].rect = cover; // i <= first, already read
+      b[i].id = pos;
+    }
+    n = levelCount[l];
+  }
+
+  free(b);
+  return 1;
+}
+
+// Scans a leaf, exactly as RTreeSearch does.
+static int RTreeQuantSearchLeaf(const struct FrozenNode *leaf, struct Rect *r,
+                                SearchHitCallback shcb, void *cbarg,
+                                int *visited) {
+  unsigned int mask = RTreeFrozenOverlapMask(leaf, r);
+  int j, hitCount = 0;
+
+  if (visited)
+    (*visited)++;
+  for (j = 0; mask; j++, mask >>= 1)
+    if (mask & 1) {
+      hitCount++;
+      if (shcb && !shcb(leaf->child[j], cbarg))
+        break; // callback wants to terminate search early
+    }
+  return hitCount;
+}
+
+static int RTreeQuantSearch2(const struct QuantIndex *q,
+                             const struct QuantNode *n, struct Rect *r,
+                             SearchHitCallback shcb, void *cbarg,
+                             int *visited) {
+  int qmin[NUMDIMS], qmax[NUMDIMS];
+  int hitCount = 0;
+  int i, d;
+
+  if (visited)
+    (*visited)++;
+
+  // Query on the grid of n, with the same rounding as the children
+  for (d = 0; d < NUMDIMS; d++) {
+    qmin[d] = RTreeQuantClamp(
+        ceil(RTreeQuantRatio(r->boundary[d], n->origin[d], n->scale[d])));
+    qmax[d] = RTreeQuantClamp(floor(RTreeQuantRatio(
+        r->boundary[d + NUMDIMS], n->origin[d], n->scale[d])));
+  }
+
+  for (i = 0; i < n->count; i++) {
+    int hit = 1;
+    for (d = 0; d < NUMDIMS; d++)
+      hit &= n->min[d][i] <= qmax[d] && qmin[d] <= n->max[d][i];
+    if (!hit)
+      continue;
+
+    if (n->level > 1)
+      hitCount += RTreeQuantSearch2(q, &q->nodes[n->child[i]], r, shcb,
+                                    cbarg, visited);
+    else
+      hitCount += RTreeQuantSearchLeaf(&q->leaves[n->child[i]], r, shcb,
+                                       cbarg, visited);
+  }
+  return hitCount;
+}
+
+// Same as RTreeSearch, on a quantized index. If visited is not NULL, the
+// number of nodes (internal and leaves) looked at is added to it.
+int RTreeQuantSearch(const struct QuantIndex *q, struct Rect *r,
+                     SearchHitCallback shcb, void *cbarg, int *visited) {
+  assert(q && q->leaves);
+  assert(r);
+
+  if (q->nodeCount == 0) // a single leaf
+    return RTreeQuantSearchLeaf(&q->leaves[0], r, shcb, cbarg, visited);
+  return RTreeQuantSearch2(q, &q->nodes[0], r, shcb, cbarg, visited);
+}
+
+void RTreeFreeQuantized(struct QuantIndex *q) {
+  free(q->nodes);
+  free(q->leaves);
+  q->nodes = NULL;
+  q->leaves = NULL;
+  q->nodeCount = 0;
+  q->leafCount = 0;
+}
@@ -0,0 +1,352 @@
+#include "CARD.H"
+#include "Index.h"
+#include "assert.h"
+#include <stddef.h>
+
+/*-----------------------------------------------------------------------------
+| R*-tree insertion (Beckmann, Kriegel, Schneider & Seeger, 1990).
+| A third insertion/split module next to the linear and quadratic ones:
+| - ChooseSubtree minimizes the overlap enlargement when the children are
+|   leaves, the area enlargement above,
+| - on the first overflow of a level during one insertion, about 30% of the
+|   entries (the farthest from the node center) are removed and reinserted
+|   instead of splitting ("forced reinsert"),
+| - the split chooses the axis with the smallest margin sum, then the
+|   distribution with the smallest overlap (then area) along that axis.
+| The result is a regular tree of struct Node, searched by RTreeSearch.
+-----------------------------------------------------------------------------*/
+
+/* Share of the entries reinserted on a first overflow */
+#define RSTAR_REINSERT_PERCENT 30
+
+/* Minimum fill of the split distributions, 40% as advised by the authors */
+#define RSTAR_MINFILL(max) ((max) * 2 / 5 > 0 ? (max) * 2 / 5 : 1)
+
+/* Bookkeeping of one top level insertion */
+struct RStarInsert {
+  struct Node *root;
+  int reinserted[RTREE_MAX_HEIGHT]; /* overflow already treated at level */
+  int shrunk;                      /* a node lost entries on the way down */
+  struct Branch pending[RTREE_MAX_HEIGHT * MAXCARD]; /* entries to reinsert */
+  int pendingLevel[RTREE_MAX_HEIGHT * MAXCARD];
+  int npending, next;
+};
+
+static RectReal RStarArea(struct Rect *r) { return RTreeRectVolume(r); }
+
+static RectReal RStarMargin(struct Rect *r) {
+  RectReal margin = 0;
+  int i;
+  for (i = 0; i < NUMDIMS; i++)
+    margin += r->boundary[i + NUMDIMS] - r->boundary[i];
+  return margin;
+}
+
+// Area of the intersection of two rects, 0 if they do not overlap.
+static RectReal RStarOverlap(struct Rect *r, struct Rect *s) {
+  RectReal area = 1;
+  int i;
+  for (i = 0; i < NUMDIMS; i++) {
+    RectReal lo = r->boundary[i] > s->boundary[i] ? r->boundary[i]
+                                                  : s->boundary[i];
+    RectReal hi = r->boundary[i + NUMDIMS] < s->boundary[i + NUMDIMS]
+                      ? r->boundary[i + NUMDIMS]
+                      : s->boundary[i + NUMDIMS];
+    if (hi <= lo)
+      return 0;
+    area *= hi - lo;
+  }
+  return area;
+}
+
+// ChooseSubtree. When the children of n are leaves, pick the branch whose
+// overlap with its siblings grows the least, resolving ties by the least
+// area enlargement, then the smallest area. Higher up, pick the least area
+// enlargement, then the smallest area.
+//
+int RTreePickBranchRStar(struct Rect *r, struct Node *n) {
+  int i, j, best = -1;
+  RectReal bestOverlap = 0, bestIncr = 0, bestArea = 0;
+  assert(r && n);
+
+  for (i = 0; i < n->count; i++) {
+    struct Rect *rr = &n->branch[i].rect;
+    struct Rect grown;
+    RectReal area, increase, overlap = 0;
+
+    grown = RTreeCombineRect(r, rr);
+    area = RStarArea(rr);
+    increase = RStarArea(&grown) - area;
+
+    if (n->level == 1) {
+      for (j = 0; j < n->count; j++)
+        if (j != i)
+          overlap += RStarOverlap(&grown, &n->branch[j].rect) -
+                     RStarOverlap(rr, &n->branch[j].rect);
+    }
+
+    if (best < 0 || overlap < bestOverlap ||
+        (overlap == bestOverlap &&
+         (increase < bestIncr || (increase == bestIncr && area < bestArea)))) {
+      best = i;
+      bestOverlap = overlap;
+      bestIncr = increase;
+      bestArea = area;
+    }
+  }
+  return best;
+}
+
+// Load the branch buffer of c with the entries of the full node n plus b,
+// and clear n (keeping its level).
+static void RStarGetBranches(struct RTreeContext *c, struct Node *n,
+                             struct Branch *b) {
+  int i, level = n->level;
+
+  c->BranchCount = 0;
+  for (i = 0; i < n->count; i++)
+    c->BranchBuf[c->BranchCount++] = n->branch[i];
+  c->BranchBuf[c->BranchCount++] = *b;
+
+  RTreeInitNode(n);
+  n->level = level;
+}
+
+// Sort the indices of the branch buffer by the low (side 0) or high
+// (side 1) boundary along axis. Insertion sort, there are at most MAXCARD+1.
+static void RStarSortAxis(struct RTreeContext *c, int *order, int axis,
+                          int side) {
+  int k = axis + side * NUMDIMS;
+  int i, j;
+  for (i = 0; i < c->BranchCount; i++)
+    order[i] = i;
+  for (i = 1; i < c->BranchCount; i++) {
+    int x = order[i];
+    RectReal key = c->BranchBuf[x].rect.boundary[k];
+    for (j = i; j > 0 && c->BranchBuf[order[j - 1]].rect.boundary[k] > key;
+         j--)
+      order[j] = order[j - 1];
+    order[j] = x;
+  }
+}
+
+// Covers of the first k (prefix[k-1]) and last total-k (suffix[k]) entries
+// of the buffer in the given order.
+static void RStarCovers(struct RTreeContext *c, int *order,
+                        struct Rect *prefix, struct Rect *suffix) {
+  int total = c->BranchCount, i;
+  prefix[0] = c->BranchBuf[order[0]].rect;
+  for (i = 1; i < total; i++)
+    prefix[i] = RTreeCombineRect(&prefix[i - 1], &c->BranchBuf[order[i]].rect);
+  suffix[total - 1] = c->BranchBuf[order[total - 1]].rect;
+  for (i = total - 2; i >= 0; i--)
+    suffix[i] = RTreeCombineRect(&suffix[i + 1], &c->BranchBuf[order[i]].rect);
+}
+
+// R* split of the full node n plus the extra branch b.
+// n keeps the first group, *nn receives the second one.
+//
+void RTreeSplitNodeRStar(struct RTreeContext *c, struct Node *n,
+                         struct Branch *b, struct Node **nn) {
+  int order[MAXCARD + 1], bestOrder[MAXCARD + 1];
+  struct Rect prefix[MAXCARD + 1], suffix[MAXCARD + 1];
+  int axis, side, k, i, total, minfill, bestAxis = 0, bestK = 0;
+  int level = n->level;
+  RectReal margin, bestMargin = -1, bestOverlap = -1, bestArea = -1;
+
+  assert(n && b && nn);
+  minfill = RSTAR_MINFILL(MAXKIDS(c, n));
+  RStarGetBranches(c, n, b);
+  total = c->BranchCount;
+
+  /* ChooseSplitAxis: smallest sum of margins over all distributions */
+  for (axis = 0; axis < NUMDIMS; axis++) {
+    margin = 0;
+    for (side = 0; side < 2; side++) {
+      RStarSortAxis(c, order, axis, side);
+      RStarCovers(c, order, prefix, suffix);
+      for (k = minfill; k <= total - minfill; k++)
+        margin += RStarMargin(&prefix[k - 1]) + RStarMargin(&suffix[k]);
+    }
+    if (bestMargin < 0 || margin < bestMargin) {
+      bestMargin = margin;
+      bestAxis = axis;
+    }
+  }
+
+  /* ChooseSplitIndex: smallest overlap, then smallest area, on that axis */
+  for (side = 0; side < 2; side++) {
+    RStarSortAxis(c, order, bestAxis, side);
+    RStarCovers(c, order, prefix, suffix);
+    for (k = minfill; k <= total - minfill; k++) {
+      RectReal overlap = RStarOverlap(&prefix[k - 1], &suffix[k]);
+      RectReal area = RStarArea(&prefix[k - 1]) + RStarArea(&suffix[k]);
+      if (bestOverlap < 0 || overlap < bestOverlap ||
+          (overlap == bestOverlap && area < bestArea)) {
+        bestOverlap = overlap;
+        bestArea = area;
+        bestK = k;
+        for (i = 0; i < total; i++)
+          bestOrder[i] = order[i];
+      }
+    }
+  }
+
+  *nn = RTreeNewNode(c);
+  (*nn)->level = level;
+  for (i = 0; i < total; i++)
+    RTreeAddBranch(c, &c->BranchBuf[bestOrder[i]], i < bestK ? n : *nn,
+                   NULL);
+  assert(n->count + (*nn)->count == total);
+}
+
+// Forced reinsert: keep the entries of n (plus b) closest to the center of
+// their cover, queue the RSTAR_REINSERT_PERCENT farthest for reinsertion at
+// the same level, closest first ("close reinsert").
+static void RStarReinsert(struct RTreeContext *c, struct Node *n,
+                          struct Branch *b, struct RStarInsert *ins) {
+  int order[MAXCARD + 1];
+  RectReal dist[MAXCARD + 1];
+  struct Rect cover;
+  int i, j, total, p;
+
+  RStarGetBranches(c, n, b);
+  total = c->BranchCount;
+  p = total * RSTAR_REINSERT_PERCENT / 100;
+  if (p < 1)
+    p = 1;
+
+  cover = c->BranchBuf[0].rect;
+  for (i = 1; i < total; i++)
+    cover = RTreeCombineRect(&cover, &c->BranchBuf[i].rect);
+
+  /* squared distance between centers, entries sorted by increasing distance */
+  for (i = 0; i < total; i++) {
+    struct Rect *r = &c->BranchBuf[i].rect;
+    RectReal d = 0;
+    for (j = 0; j < NUMDIMS; j++) {
+      RectReal delta = (r->boundary[j] + r->boundary[j + NUMDIMS]) -
+                       (cover.boundary[j] + cover.boundary[j + NUMDIMS]);
+      d += delta * delta;
+    }
+    dist[i] = d;
+    order[i] = i;
+  }
+  for (i = 1; i < total; i++) {
+    int x = order[i];
+    for (j = i; j > 0 && dist[order[j - 1]] > dist[x]; j--)
+      order[j] = order[j - 1];
+    order[j] = x;
+  }
+
+  for (i = 0; i < total - p; i++)
+    RTreeAddBranch(c, &c->BranchBuf[order[i]], n, NULL);
+  for (; i < total; i++) {
+    assert(ins->npending < RTREE_MAX_HEIGHT * MAXCARD);
+    ins->pending[ins->npending] = c->BranchBuf[order[i]];
+    ins->pendingLevel[ins->npending++] = n->level;
+  }
+  ins->shrunk = 1;
+}
+
+// Add b to n. On overflow, do a forced reinsert the first time this level
+// overflows during the insertion (never at the root, nor at or above level
+// RTREE_MAX_HEIGHT, which bounds the pending entries), split otherwise.
+// Returns 1 if n was split, with the new node in *new_node.
+static int RStarAddBranch(struct RTreeContext *c, struct Branch *b,
+                          struct Node *n, struct Node **new_node,
+                          struct RStarInsert *ins) {
+  if (n->count < MAXKIDS(c, n)) {
+    RTreeAddBranch(c, b, n, NULL);
+    return 0;
+  }
+  if (n != ins->root && n->level < RTREE_MAX_HEIGHT &&
+      !ins->reinserted[n->level]) {
+    ins->reinserted[n->level] = 1;
+    RStarReinsert(c, n, b, ins);
+    return 0;
+  }
+  RTreeSplitNodeRStar(c, n, b, new_node);
+  return 1;
+}
+
+// Recursive part of the insertion of branch b at the given level.
+// Same contract as RTreeInsertRect2 in Index.c.
+static int RStarInsert2(struct RTreeContext *c, struct Branch *b,
+                        struct Node *n, struct Node **new_node, int level,
+                        struct RStarInsert *ins) {
+  struct Node *n2;
+  struct Branch nb;
+  int i;
+
+  if (n->level > level) {
+    i = RTreePickBranchRStar(&b->rect, n);
+    if (!RStarInsert2(c, b, n->branch[i].child, &n2, level, ins)) {
+      // child was not split, but it may have lost entries
+      if (ins->shrunk)
+        n->branch[i].rect = RTreeNodeCover(n->branch[i].child);
+      else
+        n->branch[i].rect = RTreeCombineRect(&b->rect, &n->branch[i].rect);
+      return 0;
+    }
+    n->branch[i].rect = RTreeNodeCover(n->branch[i].child);
+    nb.child = n2;
+    nb.rect = RTreeNodeCover(n2);
+    return RStarAddBranch(c, &nb, n, new_node, ins);
+  }
+  assert(n->level == level);
+  return RStarAddBranch(c, b, n, new_node, ins);
+}
+
+// Insert branch b at the given level, growing a new root on a root split.
+static void RStarInsertBranch(struct RTreeContext *c, struct Branch *b,
+                              struct Node **root, int level,
+                              struct RStarInsert *ins) {
+  struct Node *newnode, *newroot;
+  struct Branch rb;
+
+  ins->root = *root;
+  ins->shrunk = 0;
+  if (RStarInsert2(c, b, *root, &newnode, level, ins)) /* root split */
+  {
+    newroot = RTreeNewNode(c); /* grow a new root, & tree taller */
+    newroot->level = (*root)->level + 1;
+    rb.rect = RTreeNodeCover(*root);
+    rb.child = *root;
+    RTreeAddBranch(c, &rb, newroot, NULL);
+    rb.rect = RTreeNodeCover(newnode);
+    rb.child = newnode;
+    RTreeAddBranch(c, &rb, newroot, NULL);
+    *root = newroot;
+  }
+}
+
+// Insert branch b at the given level of an index structure with the R*
+// heuristics: a data rect (level 0, ID MUST NEVER BE ZERO) or a subtree.
+// Same arguments and conventions as RTreeInsertBranch; returns 1 if the tree
+// grew taller.
+//
+int RTreeInsertBranchRStar(struct RTreeContext *c, struct Branch *nb,
+                           struct Node **root, int level) {
+  struct RStarInsert ins;
+  struct Branch b;
+  int i, height;
+
+  assert(c && nb && root);
+  assert(level >= 0 && level <= (*root)->level);
+  height = (*root)->level;
+
+  for (i = 0; i < RTREE_MAX_HEIGHT; i++)
+    ins.reinserted[i] = 0;
+  ins.npending = ins.next = 0;
+
+  b = *nb;
+  RStarInsertBranch(c, &b, root, level, &ins);
+
+  /* reinsertions may queue further reinsertions at other levels */
+  while (ins.next < ins.npending) {
+    b = ins.pending[ins.next];
+    RStarInsertBranch(c, &b, root, ins.pendingLevel[ins.next++], &ins);
+  }
+  return (*root)->level > height;
+}
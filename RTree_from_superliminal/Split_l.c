@@ -3,13 +3,12 @@
 #include "assert.h"
 #include "Index.h"
 #include "CARD.H"
-#include "Split_l.h"
 
 
 /*-----------------------------------------------------------------------------
 | Load branch buffer with branches from full node plus the extra branch.
 -----------------------------------------------------------------------------*/
-static void RTreeGetBranches(struct Node *N, struct Branch *B)
+static void RTreeGetBranches(struct RTreeContext *c, struct Node *N, struct Branch *B)
 {
 	register struct Node *n = N;
 	register struct Branch *b = B;
@@ -19,19 +18,19 @@ static void RTreeGetBranches(struct Node *N, struct Branch *B)
 	assert(b);
 
 	/* load the branch buffer */
-	for (i=0; i<MAXKIDS(n); i++)
+	for (i=0; i<MAXKIDS(c, n); i++)
 	{
 		assert(n->branch[i].child);  /* every entry should be full */
-		BranchBuf[i] = n->branch[i];
+		c->BranchBuf[i] = n->branch[i];
 	}
-	BranchBuf[MAXKIDS(n)] = *b;
-	BranchCount = MAXKIDS(n) + 1;
+	c->BranchBuf[MAXKIDS(c, n)] = *b;
+	c->BranchCount = MAXKIDS(c, n) + 1;
 
 	/* calculate rect containing all in the set */
-	CoverSplit = BranchBuf[0].rect;
-	for (i=1; i<MAXKIDS(n)+1; i++)
+	c->CoverSplit = c->BranchBuf[0].rect;
+	for (i=1; i<MAXKIDS(c, n)+1; i++)
 	{
-		CoverSplit = RTreeCombineRect(&CoverSplit, &BranchBuf[i].rect);
+		c->CoverSplit = RTreeCombineRect(&c->CoverSplit, &c->BranchBuf[i].rect);
 	}
 
 	RTreeInitNode(n);
@@ -63,7 +62,7 @@ static void RTreeInitPVars(struct PartitionVars *P, int maxrects, int minfill)
 /*-----------------------------------------------------------------------------
 | Put a branch in one of the groups.
 -----------------------------------------------------------------------------*/
-static void RTreeClassify(int i, int group, struct PartitionVars *p)
+static void RTreeClassify(struct RTreeContext *c, int i, int group, struct PartitionVars *p)
 {
 	assert(p);
 	assert(!p->taken[i]);
@@ -72,9 +71,9 @@ static void RTreeClassify(int i, int group, struct PartitionVars *p)
 	p->taken[i] = TRUE;
 
 	if (p->count[group] == 0)
-		p->cover[group] = BranchBuf[i].rect;
+		p->cover[group] = c->BranchBuf[i].rect;
 	else
-		p->cover[group] = RTreeCombineRect(&BranchBuf[i].rect,
+		p->cover[group] = RTreeCombineRect(&c->BranchBuf[i].rect,
 					&p->cover[group]);
 	p->area[group] = RTreeRectSphericalVolume(&p->cover[group]);
 	p->count[group]++;
@@ -88,7 +87,7 @@ static void RTreeClassify(int i, int group, struct PartitionVars *p)
 | Distance for separation or overlap is measured modulo the width of the
 | space covered by the entire set along that dimension.
 -----------------------------------------------------------------------------*/
-static void RTreePickSeeds(struct PartitionVars *P)
+static void RTreePickSeeds(struct RTreeContext *c, struct PartitionVars *P)
 {
 	register struct PartitionVars *p = P;
 	register int i, dim, high;
@@ -106,24 +105,24 @@ static void RTreePickSeeds(struct PartitionVars *P)
 		/* find the rectangles farthest out in each direction
 		 * along this dimens */
 		greatestLower[dim] = leastUpper[dim] = 0;
-		for (i=1; i<NODECARD+1; i++)
+		for (i=1; i<c->BranchCount; i++)
 		{
-			r = &BranchBuf[i].rect;
+			r = &c->BranchBuf[i].rect;
 			if (r->boundary[dim] >
-			    BranchBuf[greatestLower[dim]].rect.boundary[dim])
+			    c->BranchBuf[greatestLower[dim]].rect.boundary[dim])
 			{
 				greatestLower[dim] = i;
 			}
 			if (r->boundary[high] <
-			    BranchBuf[leastUpper[dim]].rect.boundary[high])
+			    c->BranchBuf[leastUpper[dim]].rect.boundary[high])
 			{
 				leastUpper[dim] = i;
 			}
 		}
 
 		/* find width of the whole collection along this dimension */
-		width[dim] = CoverSplit.boundary[high] -
-			     CoverSplit.boundary[dim];
+		width[dim] = c->CoverSplit.boundary[high] -
+			     c->CoverSplit.boundary[dim];
 	}
 
 	/* pick the best separation dimension and the two seed rects */
@@ -138,8 +137,8 @@ static void RTreePickSeeds(struct PartitionVars *P)
 		else
 			w = width[dim];
 
-		rlow = &BranchBuf[leastUpper[dim]].rect; 
-		rhigh = &BranchBuf[greatestLower[dim]].rect;
+		rlow = &c->BranchBuf[leastUpper[dim]].rect; 
+		rhigh = &c->BranchBuf[greatestLower[dim]].rect;
 		if (dim == 0)
 		{
 			seed0 = leastUpper[0];
@@ -164,8 +163,8 @@ static void RTreePickSeeds(struct PartitionVars *P)
 
 	if (seed0 != seed1)
 	{
-		RTreeClassify(seed0, 0, p);
-		RTreeClassify(seed1, 1, p);
+		RTreeClassify(c, seed0, 0, p);
+		RTreeClassify(c, seed1, 1, p);
 	}
 }
 
@@ -186,26 +185,26 @@ static void RTreePickSeeds(struct PartitionVars *P)
 |
 | Also update the covers for both groups.
 -----------------------------------------------------------------------------*/
-static void RTreePigeonhole(struct PartitionVars *P)
+static void RTreePigeonhole(struct RTreeContext *c, struct PartitionVars *P)
 {
 	register struct PartitionVars *p = P;
 	struct Rect newCover[2];
 	register int i, group;
 	RectReal newArea[2], increase[2];
 
-	for (i=0; i<NODECARD+1; i++)
+	for (i=0; i<c->BranchCount; i++)
 	{
 		if (!p->taken[i])
 		{
 			/* if one group too full, put rect in the other */
 			if (p->count[0] >= p->total - p->minfill)
 			{
-				RTreeClassify(i, 1, p);
+				RTreeClassify(c, i, 1, p);
 				continue;
 			}
 			else if (p->count[1] >= p->total - p->minfill)
 			{
-				RTreeClassify(i, 0, p);
+				RTreeClassify(c, i, 0, p);
 				continue;
 			}
 
@@ -214,10 +213,10 @@ static void RTreePigeonhole(struct PartitionVars *P)
 			{
 				if (p->count[group]>0)
 					newCover[group] = RTreeCombineRect(
-						&BranchBuf[i].rect,
+						&c->BranchBuf[i].rect,
 						&p->cover[group]);
 				else
-					newCover[group] = BranchBuf[i].rect;
+					newCover[group] = c->BranchBuf[i].rect;
 				newArea[group] = RTreeRectSphericalVolume(
 							&newCover[group]);
 				increase[group] = newArea[group]-p->area[group];
@@ -225,24 +224,24 @@ static void RTreePigeonhole(struct PartitionVars *P)
 
 			/* put rect in group whose cover will expand less */
 			if (increase[0] < increase[1])
-				RTreeClassify(i, 0, p);
+				RTreeClassify(c, i, 0, p);
 			else if (increase[1] < increase[0])
-				RTreeClassify(i, 1, p);
+				RTreeClassify(c, i, 1, p);
 
 			/* put rect in group that will have a smaller cover */
 			else if (p->area[0] < p->area[1])
-				RTreeClassify(i, 0, p);
+				RTreeClassify(c, i, 0, p);
 			else if (p->area[1] < p->area[0])
-				RTreeClassify(i, 1, p);
+				RTreeClassify(c, i, 1, p);
 
 			/* put rect in group with fewer elements */
 			else if (p->count[0] < p->count[1])
-				RTreeClassify(i, 0, p);
+				RTreeClassify(c, i, 0, p);
 			else
-				RTreeClassify(i, 1, p);
+				RTreeClassify(c, i, 1, p);
 		}
 	}
-	assert(p->count[0] + p->count[1] == NODECARD + 1);
+	assert(p->count[0] + p->count[1] == c->BranchCount);
 }
 
 
@@ -252,11 +251,11 @@ static void RTreePigeonhole(struct PartitionVars *P)
 | First find two seeds, one for each group, well separated.
 | Then put other rects in whichever group will be smallest after addition.
 -----------------------------------------------------------------------------*/
-static void RTreeMethodZero(struct PartitionVars *p, int minfill)
+static void RTreeMethodZero(struct RTreeContext *c, struct PartitionVars *p, int minfill)
 {
-	RTreeInitPVars(p, BranchCount, minfill);
-	RTreePickSeeds(p);
-	RTreePigeonhole(p);
+	RTreeInitPVars(p, c->BranchCount, minfill);
+	RTreePickSeeds(c, p);
+	RTreePigeonhole(c, p);
 }
 
 
@@ -265,7 +264,7 @@ static void RTreeMethodZero(struct PartitionVars *p, int minfill)
 /*-----------------------------------------------------------------------------
 | Copy branches from the buffer into two nodes according to the partition.
 -----------------------------------------------------------------------------*/
-static void RTreeLoadNodes(struct Node *N, struct Node *Q,
+static void RTreeLoadNodes(struct RTreeContext *c, struct Node *N, struct Node *Q,
 			struct PartitionVars *P)
 {
 	register struct Node *n = N, *q = Q;
@@ -275,12 +274,12 @@ static void RTreeLoadNodes(struct Node *N, struct Node *Q,
 	assert(q);
 	assert(p);
 
-	for (i=0; i<NODECARD+1; i++)
+	for (i=0; i<c->BranchCount; i++)
 	{
 		if (p->partition[i] == 0)
-			RTreeAddBranch(&BranchBuf[i], n, NULL);
+			RTreeAddBranch(c, &c->BranchBuf[i], n, NULL);
 		else if (p->partition[i] == 1)
-			RTreeAddBranch(&BranchBuf[i], q, NULL);
+			RTreeAddBranch(c, &c->BranchBuf[i], q, NULL);
 		else
 			assert(FALSE);
 	}
@@ -293,74 +292,27 @@ static void RTreeLoadNodes(struct Node *N, struct Node *Q,
 | Divides the nodes branches and the extra one between two nodes.
 | Old node is one of the new ones, and one really new one is created.
 -----------------------------------------------------------------------------*/
-void RTreeSplitNode(struct Node *n, struct Branch *b, struct Node **nn)
+void RTreeSplitNodeLinear(struct RTreeContext *c, struct Node *n, struct Branch *b, struct Node **nn)
 {
 	register struct PartitionVars *p;
 	register int level;
-	RectReal area;
 
 	assert(n);
 	assert(b);
 
 	/* load all the branches into a buffer, initialize old node */
 	level = n->level;
-	RTreeGetBranches(n, b);
+	RTreeGetBranches(c, n, b);
 
 	/* find partition */
-	p = &Partitions[0];
+	p = &c->Partitions[0];
 
 	/* Note: can't use MINFILL(n) below since n was cleared by GetBranches() */
-	RTreeMethodZero(p, level>0 ? MinNodeFill : MinLeafFill);
-
-	/* record how good the split was for statistics */
-	area = p->area[0] + p->area[1];
+	RTreeMethodZero(c, p, level>0 ? MinNodeFill(c) : MinLeafFill(c));
 
 	/* put branches from buffer in 2 nodes according to chosen partition */
-	*nn = RTreeNewNode();
+	*nn = RTreeNewNode(c);
 	(*nn)->level = n->level = level;
-	RTreeLoadNodes(n, *nn, p);
-	assert(n->count + (*nn)->count == NODECARD+1);
-}
-
-
-
-/*-----------------------------------------------------------------------------
-| Print out data for a partition from PartitionVars struct.
------------------------------------------------------------------------------*/
-static void RTreePrintPVars(struct PartitionVars *p)
-{
-	int i;
-	assert(p);
-
-	printf("\npartition:\n");
-	for (i=0; i<NODECARD+1; i++)
-	{
-		printf("%3d\t", i);
-	}
-	printf("\n");
-	for (i=0; i<NODECARD+1; i++)
-	{
-		if (p->taken[i])
-			printf("  t\t");
-		else
-			printf("\t");
-	}
-	printf("\n");
-	for (i=0; i<NODECARD+1; i++)
-	{
-		printf("%3d\t", p->partition[i]);
-	}
-	printf("\n");
-
-	printf("count[0] = %d  area = %f\n", p->count[0], p->area[0]);
-	printf("count[1] = %d  area = %f\n", p->count[1], p->area[1]);
-	printf("total area = %f  effectiveness = %3.2f\n",
-		p->area[0] + p->area[1],
-		RTreeRectSphericalVolume(&CoverSplit)/(p->area[0]+p->area[1]));
-
-	printf("cover[0]:\n");
-	RTreePrintRect(&p->cover[0], 0);
-
-	printf("cover[1]:\n");
-	RTreePrintRect(&p->cover[1], 0);
+	RTreeLoadNodes(c, n, *nn, p);
+	assert(n->count + (*nn)->count == c->BranchCount);
 }
@@ -3,15 +3,14 @@
 #include "assert.h"
 #include "Index.h"
 #include "CARD.H"
-#include "SPLIT_Q.H"
 
-//ed. note to myself : what is MAXKIDS(n) ?
+//ed. note to myself : what is MAXKIDS(c, n) ?
 
 
 /*-----------------------------------------------------------------------------
 | Load branch buffer with branches from full node plus the extra branch.
 -----------------------------------------------------------------------------*/
-static void RTreeGetBranches(struct Node *n, struct Branch *b)
+static void RTreeGetBranches(struct RTreeContext *c, struct Node *n, struct Branch *b)
 {
 	register int i;
 
@@ -19,21 +18,21 @@ static void RTreeGetBranches(struct Node *n, struct Branch *b)
 	assert(b);
 
 	/* load the branch buffer */
-	for (i=0; i<MAXKIDS(n); i++)
+	for (i=0; i<MAXKIDS(c, n); i++)
 	{
 		assert(n->branch[i].child); /* n should have every entry full */
-		BranchBuf[i] = n->branch[i];
+		c->BranchBuf[i] = n->branch[i];
 	}
-	BranchBuf[MAXKIDS(n)] = *b; 
-	BranchCount = MAXKIDS(n) + 1;
+	c->BranchBuf[MAXKIDS(c, n)] = *b; 
+	c->BranchCount = MAXKIDS(c, n) + 1;
 
 	/* calculate rect containing all in the set */
-	CoverSplit = BranchBuf[0].rect;
-	for (i=1; i<MAXKIDS(n)+1; i++)
+	c->CoverSplit = c->BranchBuf[0].rect;
+	for (i=1; i<MAXKIDS(c, n)+1; i++)
 	{
-		CoverSplit = RTreeCombineRect(&CoverSplit, &BranchBuf[i].rect);
+		c->CoverSplit = RTreeCombineRect(&c->CoverSplit, &c->BranchBuf[i].rect);
 	}
-	CoverSplitArea = RTreeRectSphericalVolume(&CoverSplit);
+	c->CoverSplitArea = RTreeRectSphericalVolume(&c->CoverSplit);
 
 	RTreeInitNode(n);
 }
@@ -44,7 +43,7 @@ static void RTreeGetBranches(struct Node *n, struct Branch *b)
 /*-----------------------------------------------------------------------------
 | Put a branch in one of the groups.
 -----------------------------------------------------------------------------*/
-static void RTreeClassify(int i, int group, struct PartitionVars *p)
+static void RTreeClassify(struct RTreeContext *c, int i, int group, struct PartitionVars *p)
 {
 	assert(p);
 	assert(!p->taken[i]);
@@ -53,10 +52,10 @@ static void RTreeClassify(int i, int group, struct PartitionVars *p)
 	p->taken[i] = TRUE;
 
 	if (p->count[group] == 0)
-		p->cover[group] = BranchBuf[i].rect;
+		p->cover[group] = c->BranchBuf[i].rect;
 	else
 		p->cover[group] =
-			RTreeCombineRect(&BranchBuf[i].rect, &p->cover[group]);
+			RTreeCombineRect(&c->BranchBuf[i].rect, &p->cover[group]);
 	p->area[group] = RTreeRectSphericalVolume(&p->cover[group]);
 	p->count[group]++;
 }
@@ -68,22 +67,22 @@ static void RTreeClassify(int i, int group, struct PartitionVars *p)
 | Pick two rects from set to be the first elements of the two groups.
 | Pick the two that waste the most area if covered by a single rectangle.
 -----------------------------------------------------------------------------*/
-static void RTreePickSeeds(struct PartitionVars *p)
+static void RTreePickSeeds(struct RTreeContext *c, struct PartitionVars *p)
 {
 	register int i, j, seed0, seed1;
 	RectReal worst, waste, area[MAXCARD+1]; 
 
 	for (i=0; i<p->total; i++)
-		area[i] = RTreeRectSphericalVolume(&BranchBuf[i].rect);
+		area[i] = RTreeRectSphericalVolume(&c->BranchBuf[i].rect);
 
-	worst = -CoverSplitArea - 1;
+	worst = -c->CoverSplitArea - 1;
 	for (i=0; i<p->total-1; i++)
 	{
 		for (j=i+1; j<p->total; j++)
 		{
 			struct Rect one_rect = RTreeCombineRect(
-						&BranchBuf[i].rect,
-						&BranchBuf[j].rect);
+						&c->BranchBuf[i].rect,
+						&c->BranchBuf[j].rect);
 			waste = RTreeRectSphericalVolume(&one_rect) -
 					area[i] - area[j]; //ed. imagine two rect inside a bigger one : the waste is the area that is inside that bigger rect but not in either one of the small two
 			if (waste > worst)
@@ -94,8 +93,8 @@ static void RTreePickSeeds(struct PartitionVars *p)
 			}
 		}
 	}
-	RTreeClassify(seed0, 0, p);
-	RTreeClassify(seed1, 1, p);
+	RTreeClassify(c, seed0, 0, p);
+	RTreeClassify(c, seed1, 1, p);
 }
 
 
@@ -104,7 +103,7 @@ static void RTreePickSeeds(struct PartitionVars *p)
 /*-----------------------------------------------------------------------------
 | Copy branches from the buffer into two nodes according to the partition.
 -----------------------------------------------------------------------------*/
-static void RTreeLoadNodes(struct Node *n, struct Node *q,
+static void RTreeLoadNodes(struct RTreeContext *c, struct Node *n, struct Node *q,
 			struct PartitionVars *p)
 {
 	register int i;
@@ -116,9 +115,9 @@ static void RTreeLoadNodes(struct Node *n, struct Node *q,
 	{
 		assert(p->partition[i] == 0 || p->partition[i] == 1);
 		if (p->partition[i] == 0)
-			RTreeAddBranch(&BranchBuf[i], n, NULL);
+			RTreeAddBranch(c, &c->BranchBuf[i], n, NULL);
 		else if (p->partition[i] == 1)
-			RTreeAddBranch(&BranchBuf[i], q, NULL);
+			RTreeAddBranch(c, &c->BranchBuf[i], q, NULL);
 	}
 }
 
@@ -151,7 +150,7 @@ static void RTreeInitPVars(struct PartitionVars *p, int maxrects, int minfill)
 /*-----------------------------------------------------------------------------
 | Print out data for a partition from PartitionVars struct.
 -----------------------------------------------------------------------------*/
-static void RTreePrintPVars(struct PartitionVars *p)
+static void RTreePrintPVars(struct RTreeContext *c, struct PartitionVars *p)
 {
 	register int i;
 	assert(p);
@@ -182,7 +181,7 @@ static void RTreePrintPVars(struct PartitionVars *p)
 	{
 		printf("total area = %f  effectiveness = %3.2f\n",
 			p->area[0] + p->area[1],
-			(float)CoverSplitArea / (p->area[0] + p->area[1]));
+			(float)c->CoverSplitArea / (p->area[0] + p->area[1]));
 	}
 	printf("cover[0]:\n");
 	RTreePrintRect(&p->cover[0], 0);
@@ -205,15 +204,15 @@ static void RTreePrintPVars(struct PartitionVars *p)
 | fill requirement) then other group gets the rest.
 | These last are the ones that can go in either group most easily.
 -----------------------------------------------------------------------------*/
-static void RTreeMethodZero(struct PartitionVars *p, int minfill)
+static void RTreeMethodZero(struct RTreeContext *c, struct PartitionVars *p, int minfill)
 {
 	register int i;
 	RectReal biggestDiff;
 	register int group, chosen, betterGroup;
 	assert(p);
 
-	RTreeInitPVars(p, BranchCount, minfill);
-	RTreePickSeeds(p);
+	RTreeInitPVars(p, c->BranchCount, minfill);
+	RTreePickSeeds(c, p);
 
 	while (p->count[0] + p->count[1] < p->total
 		&& p->count[0] < p->total - p->minfill
@@ -227,7 +226,7 @@ static void RTreeMethodZero(struct PartitionVars *p, int minfill)
 				struct Rect *r, rect_0, rect_1;
 				RectReal growth0, growth1, diff;
 
-				r = &BranchBuf[i].rect;
+				r = &c->BranchBuf[i].rect;
 				rect_0 = RTreeCombineRect(r, &p->cover[0]);
 				rect_1 = RTreeCombineRect(r, &p->cover[1]);
 				growth0 = RTreeRectSphericalVolume(
@@ -257,7 +256,7 @@ static void RTreeMethodZero(struct PartitionVars *p, int minfill)
 				}
 			}
 		}
-		RTreeClassify(chosen, betterGroup, p);
+		RTreeClassify(c, chosen, betterGroup, p);
 	}
 
 	/* if one group too full, put remaining rects in the other */
@@ -270,7 +269,7 @@ static void RTreeMethodZero(struct PartitionVars *p, int minfill)
 		for (i=0; i<p->total; i++)
 		{
 			if (!p->taken[i])
-				RTreeClassify(i, group, p);
+				RTreeClassify(c, i, group, p);
 		}
 	}
 
@@ -285,7 +284,7 @@ static void RTreeMethodZero(struct PartitionVars *p, int minfill)
 | Old node is one of the new ones, and one really new one is created.
 | Tries more than one method for choosing a partition, uses best result.
 -----------------------------------------------------------------------------*/
-extern void RTreeSplitNode(struct Node *n, struct Branch *b, struct Node **nn)
+extern void RTreeSplitNodeQuadratic(struct RTreeContext *c, struct Node *n, struct Branch *b, struct Node **nn)
 {
 	register struct PartitionVars *p;
 	register int level;
@@ -295,19 +294,19 @@ extern void RTreeSplitNode(struct Node *n, struct Branch *b, struct Node **nn)
 
 	/* load all the branches into a buffer, initialize old node */
 	level = n->level;
-	RTreeGetBranches(n, b);
+	RTreeGetBranches(c, n, b);
 
 	/* find partition */
-	p = &Partitions[0];
+	p = &c->Partitions[0];
 	/* Note: can't use MINFILL(n) below since n was cleared by GetBranches() */
-	RTreeMethodZero(p, level>0 ? MinNodeFill : MinLeafFill);
+	RTreeMethodZero(c, p, level>0 ? MinNodeFill(c) : MinLeafFill(c));
 
 	/*
 	 * put branches from buffer into 2 nodes
 	 * according to chosen partition
 	 */
-	*nn = RTreeNewNode();
+	*nn = RTreeNewNode(c);
 	(*nn)->level = n->level = level;
-	RTreeLoadNodes(n, *nn, p);
+	RTreeLoadNodes(c, n, *nn, p);
 	assert(n->count+(*nn)->count == p->total);
 }
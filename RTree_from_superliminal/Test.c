@@ -13,21 +13,25 @@ struct Rect search_rect = {
 	{6, 4, 10, 6}, // search will find above rects that this one overlaps
 };
 
-int MySearchCallback(int id, void* arg) 
+int MySearchCallback(RTreeId id, void* arg) 
 {
 	// Note: -1 to make up for the +1 when data was inserted
-	printf("Hit data rect %d\n", id-1);
+	printf("Hit data rect %d\n", (int)(id-1));
 	return 1; // keep going
 }
 
 void main()
 {
-	struct Node* root = RTreeNewIndex();
+	struct RTreeContext ctx;
+	struct Node* root;
 	int i, nhits;
+	RTreeInitContext(&ctx);
+	root = RTreeNewIndex(&ctx);
 	printf("nrects = %d\n", nrects);
 	/*
 	 * Insert all the data rects.
 	 * Notes about the arguments:
+	 * parameter 0 is the per-index context (cardinalities, split buffers),
 	 * parameter 1 is the rect being inserted,
 	 * parameter 2 is its ID. NOTE: *** ID MUST NEVER BE ZERO ***, hence the +1,
 	 * parameter 3 is the root of the tree. Note: its address is passed
@@ -36,7 +40,8 @@ void main()
 	 * parameter 4 is always zero which means to add from the root.
 	 */
 	for(i=0; i<nrects; i++)
-		RTreeInsertRect(&rects[i], i+1, &root, 0); // i+1 is rect ID. Note: root can change
+		RTreeInsertRect(&ctx, &rects[i], i+1, &root, 0); // i+1 is rect ID. Note: root can change
 	nhits = RTreeSearch(root, &search_rect, MySearchCallback, 0);
 	printf("Search resulted in %d hits\n", nhits);
+	RTreeFreeIndex(&ctx); // all the nodes of the tree
 }
\ No newline at end of file
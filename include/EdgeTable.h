@@ -0,0 +1,49 @@
+#ifndef EDGETABLE_H
+#define EDGETABLE_H
+
+#include "mesh.h"
+
+// Edge functions of a list of triangles, precomputed once so that a
+// containment test is three multiply-adds per edge and no division.
+// Row r holds triangle[r]; for each edge k (corner k to corner k + 1 mod 3)
+//   E_k(x, y) = a[k][r] * x + b[k][r] * y + c[k][r]
+// is >= 0 on the inner side of the edge, whatever the winding of the
+// triangle, so (x, y) is in the triangle iff all three are >= 0.
+// Coefficients are stored as structure of arrays (one array per
+// coefficient, aligned on a cache line) to test consecutive rows together
+// with SIMD: 4 rows per instruction with AVX, 2 with SSE2. Degenerate
+// triangles get edge functions that are negative everywhere.
+typedef struct {
+  double *a[3], *b[3], *c[3];
+  MeshIndex *triangle; // Triangle of each row, or -1
+  MeshIndex rows;
+} EdgeTable;
+
+// Builds the table of the given triangles of mesh, in the given order
+// (triangles[r] for row r, -1 for a row that contains nothing), or of all of
+// them in mesh order if triangles is NULL (rows = mesh->ntri).
+// Returns 1 on success, 0 if out of memory.
+int BuildEdgeTable(const struct Mesh *mesh, const MeshIndex *triangles,
+                   MeshIndex rows, EdgeTable *table);
+void FreeEdgeTable(EdgeTable *table);
+
+// Rows tested by one vector instruction of EdgeTableMask; a search that only
+// needs a few rows gets them at no extra cost within their block.
+#if defined(__AVX__)
+#define EDGE_TABLE_BLOCK 4
+#elif defined(__SSE2__)
+#define EDGE_TABLE_BLOCK 2
+#else
+#define EDGE_TABLE_BLOCK 1
+#endif
+
+// Bit i of the result is set if (x, y) is inside the triangle of row
+// first + i, for i < count (count <= 32).
+unsigned int EdgeTableMask(const EdgeTable *table, MeshIndex first, int count,
+                           double x, double y);
+
+// First row of [first, first + count) whose triangle contains (x, y), or -1.
+MeshIndex EdgeTableFind(const EdgeTable *table, MeshIndex first,
+                        MeshIndex count, double x, double y);
+
+#endif
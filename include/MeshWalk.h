@@ -0,0 +1,42 @@
+#ifndef MESHWALK_H
+#define MESHWALK_H
+
+#include "../RTree_from_superliminal/Index.h"
+#include "mesh.h"
+
+// Edge adjacency of a mesh: neighbors[3 * t + k] is the triangle on the other
+// side of edge k of triangle t (from corner k to corner k + 1 mod 3), or -1
+// on the boundary of the mesh.
+typedef struct {
+  MeshIndex *neighbors;
+  MeshIndex ntri;
+} MeshAdjacency;
+
+// Builds the adjacency of mesh (edges are matched by sorting them).
+// Returns 1 on success, 0 if out of memory.
+int BuildMeshAdjacency(const struct Mesh *mesh, MeshAdjacency *adj);
+void FreeMeshAdjacency(MeshAdjacency *adj);
+
+// Steps after which a walk gives up and falls back to the R-Tree
+#define WALK_MAX_STEPS 64
+
+// Counters of WalkLocatePoint, accumulated over calls
+typedef struct {
+  long long queries;
+  long long steps;     // Edges crossed
+  long long fallbacks; // Queries answered by the R-Tree
+} WalkStats;
+
+// Locates (x, y) by walking across the edges of the mesh: from triangle hint
+// (e.g. the answer to the previous query of a coherent stream), or from a
+// triangle of the first R-Tree leaf on the way to the point if hint is -1.
+// Every step crosses an edge that separates the current triangle from the
+// point (orientation test). After WALK_MAX_STEPS steps, or when the walk
+// leaves the mesh, the query is answered by RTreeLocatePoint instead.
+// Returns the index of a triangle containing the point (as
+// PointInMeshTriangle), or -1. stats may be NULL.
+MeshIndex WalkLocatePoint(const MeshAdjacency *adj, struct Node *root,
+                          const struct Mesh *mesh, double x, double y,
+                          MeshIndex hint, WalkStats *stats);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef POINTSTREAM_H
+#define POINTSTREAM_H
+
+#include "../RTree_from_superliminal/Index.h"
+#include "ThreadPool.h"
+#include "mesh.h"
+
+// Streaming point location: points are read from a file or stdin, located
+// in the tree and their triangles written out, in the same order, without
+// ever holding more than a few batches in memory.
+// Three stages run concurrently on a ring of STREAM_SLOTS batches of
+// STREAM_BATCH points: a reader thread parses the input, the calling thread
+// locates (with the threads of a pool, if given), and a writer thread
+// formats the results and writes them with one fwrite per batch. Each stage
+// works on its own batch while the next one is filled or drained, so
+// throughput is bounded by the slowest stage (normally the I/O), not by
+// per-point stdio calls.
+#define STREAM_BATCH 65536
+#define STREAM_SLOTS 4
+
+typedef enum {
+  STREAM_TEXT,  // One point per line: "x y", "x,y" or "x;y" (CSV); lines
+                // starting with '#' and empty lines are skipped. Output:
+                // one line per point, "triangle" or "triangle w1 w2 w3"
+  STREAM_BINARY // Input: pairs of native doubles (x, y), memory-mapped when
+                // read from a regular file. Output: per point, the triangle
+                // as a native MeshIndex, followed by 3 doubles (weights)
+} StreamFormat;
+
+typedef struct {
+  const char *input;  // Path, or NULL or "-" for stdin
+  const char *output; // Path, or NULL or "-" for stdout
+  StreamFormat inputFormat, outputFormat;
+  int weights; // Also write the barycentric weights of the corners v1, v2, v3
+} StreamOptions;
+
+typedef struct {
+  long long points;   // Points read (and written)
+  long long outside;  // Of which outside the mesh (triangle -1)
+  long long rejected; // Lines that are not a point (located as NaN, so -1),
+                      // or 1 for a truncated binary record at the end
+  double seconds;     // Wall time of the whole stream
+  double readSeconds, locateSeconds, writeSeconds; // Busy time per stage
+} StreamStats;
+
+// Runs the stream. Each batch is located on the threads of pool (NULL: on
+// the calling thread alone); the output stays in input order. Returns 0 on
+// success, -1 if the input or the output could not be opened or an I/O
+// error occurred (the points handled until then are still written and
+// counted in stats).
+int RunPointStream(ThreadPool *pool, struct Node *root,
+                   const struct Mesh *mesh, const StreamOptions *options,
+                   StreamStats *stats);
+
+#endif
@@ -2,17 +2,329 @@
 #define RTREEWRAPPER_H
 
 #include "../RTree_from_superliminal/Index.h" // Function prototypes from 'RTree_from_superliminal'
+#include "EdgeTable.h"
+#include "ThreadPool.h"
 #include "mesh.h"
 
 // Builds an R-Tree from the given mesh.
-// Returns the root node of the R-Tree.
-struct Node *BuildRTree(const struct Mesh *mesh);
+// ctx is the per-index context (see RTreeInitContext), it must be kept with
+// the tree for later inserts or deletes. Two trees built with two different
+// contexts can be built concurrently.
+// Triangles are inserted one at a time with the insertion policy of ctx
+// (quadratic split by default, see RTreeSetPolicy).
+// Returns the root node of the R-Tree. As with every builder below, the nodes
+// are allocated in the arena of ctx: release them with RTreeFreeIndex(ctx).
+struct Node *BuildRTree(struct RTreeContext *ctx, const struct Mesh *mesh);
+
+// Same as BuildRTree, but packs the whole tree at once with the
+// Sort-Tile-Recursive bulk loader instead of inserting triangle by triangle.
+struct Node *BuildRTreeSTR(struct RTreeContext *ctx, const struct Mesh *mesh);
+
+// Same as BuildRTree, but packs the triangles in the order of their centroids
+// along a Hilbert curve (keeps neighbouring triangles in the same leaf).
+struct Node *BuildRTreeHilbert(struct RTreeContext *ctx,
+                               const struct Mesh *mesh);
+
+// Same tree as BuildRTreeHilbert, built with nthreads threads: the curve is
+// cut into chunks of whole subtrees that are packed concurrently, then the
+// upper levels are packed on top of them.
+struct Node *BuildRTreeParallel(struct RTreeContext *ctx,
+                                const struct Mesh *mesh, int nthreads);
+
+// Shape of a built tree, used to compare construction methods.
+typedef struct {
+  int height;        // Number of levels, leaves included
+  int nodes;         // Total number of nodes
+  int leaves;        // Number of leaf nodes
+  MeshIndex entries; // Number of indexed triangles
+  double leafFill;   // Average leaf occupancy (entries / capacity)
+  double leafArea;   // Sum of the leaf MBR areas
+  double overlap;    // Sum of pairwise overlap areas between sibling MBRs
+} TreeStats;
+
+void ComputeTreeStats(const struct RTreeContext *ctx, struct Node *root,
+                      TreeStats *stats);
+
+// Finger of a caller into a tree: the root-to-leaf path (nodes have no
+// parent links) and the leaf entry of the last answer of FindTriangle, plus
+// counters of where the answers were found. Initialize with
+// InitLocateCursor; reset it after the tree is modified. A tree of more than
+// RTREE_MAX_HEIGHT levels is searched from the root without a cursor.
+typedef struct {
+  struct Node *root; // Tree of the path, NULL if there is no path yet
+  struct Node *path[RTREE_MAX_HEIGHT]; // path[0] is the root
+  int slot[RTREE_MAX_HEIGHT];          // Branch of path[d + 1] in path[d]
+  int depth;                           // Leaf is path[depth]
+  int entry;                           // Entry of the leaf that answered
+  long long sameTriangle;              // Answers: the previous triangle,
+  long long sameLeaf;                  // another entry of its leaf,
+  long long climbed;                   // under an ancestor,
+  long long missed;                    // or not found
+} LocateCursor;
+
+void InitLocateCursor(LocateCursor *cursor);
 
 // Finds the index of the triangle containing point p.
 // Returns triangle index or -1 if not found.
-int FindTriangle(struct Node *root, const struct Mesh *mesh, struct Vertex p);
+// With a cursor (NULL for none), the search resumes from the last answer:
+// the previous triangle first, then the other entries of its leaf, then the
+// subtrees of the ancestors whose MBR contains p, lowest first. Queries
+// close to the previous one then skip most of the descent from the root.
+// On a point shared by several triangles, the answer can differ from the
+// one without cursor.
+MeshIndex FindTriangle(struct Node *root, const struct Mesh *mesh,
+                       struct Vertex p, LocateCursor *cursor);
+
+// Same result as FindTriangle, without the generic search: the tree is
+// walked iteratively with a fixed-size stack (trees up to RTREE_MAX_HEIGHT
+// high, FindTriangle above), branches are tested with a point-in-box test,
+// the triangles inline, and the walk stops at the first triangle
+// containing (x, y).
+// Returns triangle index or -1 if not found.
+MeshIndex RTreeLocatePoint(struct Node *root, const struct Mesh *mesh,
+                           double x, double y);
+
+// Queue entries of RTreeNearestTriangle kept on the stack before it
+// allocates
+#define NEAREST_QUEUE_LOCAL 256
+
+// Finds the k triangles nearest to (x, y), e.g. to clamp a point that falls
+// outside the mesh to its closest triangle. Best-first search: branches are
+// visited in increasing MINDIST from the point to their rect, and the
+// triangles of the leaves reached are queued with their exact distance, so
+// the search stops as soon as k triangles have come out of the queue.
+// ids[0..k-1] receive the triangles from the nearest, dist (may be NULL)
+// their distances (0 for a triangle containing the point). Returns the
+// number of triangles found, less than k only if the mesh has fewer.
+int RTreeNearestTriangle(struct Node *root, const struct Mesh *mesh, double x,
+                         double y, int k, MeshIndex *ids, double *dist);
+
+// Distance from (x, y) to triangle tri of mesh (2D, 0 inside).
+double PointTriangleDistance(const struct Mesh *mesh, MeshIndex tri,
+                             double x, double y);
+
+// Order in which FindTrianglesBatch runs the queries of a batch
+typedef enum {
+  BATCH_ORDER_INPUT, // As given
+  BATCH_ORDER_MORTON // Sorted along a Z-order (Morton) curve
+} BatchOrder;
+
+// Locates n points at once: out_ids[i] is the triangle containing
+// points[i] (as RTreeLocatePoint), or -1. With BATCH_ORDER_MORTON the
+// queries are run in Z-order of their points, so that consecutive queries
+// go through the same nodes and leaves while they are still in cache.
+void FindTrianglesBatch(struct Node *root, const struct Mesh *mesh,
+                        const struct Vertex *points, MeshIndex n,
+                        MeshIndex *out_ids, BatchOrder order);
+
+// Field given at the vertices of a mesh: components values per vertex,
+// vertex after vertex (values[i * components + c] is component c at vertex
+// i). components is 1 for a scalar field, 2 or 3 for a vector field.
+typedef struct {
+  const double *values;
+  int components;
+} VertexField;
+
+// Where a point is: its triangle (-1 outside the mesh) and its barycentric
+// weights for the corners v1, v2 and v3 of the triangle (0 outside)
+typedef struct {
+  MeshIndex triangle;
+  double weights[3];
+} PointLocation;
+
+// Locates n points (as FindTrianglesBatch) and interpolates nfields vertex
+// fields at each of them in the same pass: the barycentric weights come
+// from the containment test of the triangle found. locations[i] receives
+// the triangle and the weights of points[i], and out_values (may be NULL if
+// nfields is 0) the components of every field at points[i], field after
+// field, at out_values[i * stride] where stride is the total number of
+// components. Values are NaN for a point outside the mesh.
+void LocateAndInterpolate(struct Node *root, const struct Mesh *mesh,
+                          const struct Vertex *points, MeshIndex n,
+                          const VertexField *fields, int nfields,
+                          PointLocation *locations, double *out_values,
+                          BatchOrder order);
+
+// Per-thread counters of FindTrianglesParallel, one cache line each so that
+// threads never write to the same line.
+typedef struct {
+  long long queries; // Points located by the thread
+  long long hits;    // Of which inside a triangle
+  long long stolen;  // Chunks taken from other threads
+  char pad[64 - 3 * sizeof(long long)];
+} BatchThreadStats;
+
+// Queries per chunk of FindTrianglesParallel: the unit of work stealing
+#define BATCH_CHUNK 256
+
+// Same as FindTrianglesBatch, on the threads of pool. The queries (in
+// Morton order if requested) are cut into chunks of BATCH_CHUNK consecutive
+// queries, shared between the threads with work stealing
+// (ThreadPoolRunChunks), so that clustered query sets keep every thread
+// busy. The tree and the mesh are only read. If stats is not NULL, stats[t]
+// receives the counters of thread t (ThreadPoolSize(pool) entries).
+void FindTrianglesParallel(ThreadPool *pool, struct Node *root,
+                           const struct Mesh *mesh,
+                           const struct Vertex *points, MeshIndex n,
+                           MeshIndex *out_ids, BatchOrder order,
+                           BatchThreadStats *stats);
+
+// Same as LocateAndInterpolate in input order, on the threads of pool (in
+// chunks of BATCH_CHUNK points, as FindTrianglesParallel).
+void LocateAndInterpolateParallel(ThreadPool *pool, struct Node *root,
+                                  const struct Mesh *mesh,
+                                  const struct Vertex *points, MeshIndex n,
+                                  const VertexField *fields, int nfields,
+                                  PointLocation *locations,
+                                  double *out_values);
+
+// Same as FindTriangle, on an index frozen with RTreeFreeze.
+MeshIndex FindTriangleFrozen(const struct FrozenIndex *index,
+                             const struct Mesh *mesh, struct Vertex p);
+
+// Same as FindTriangle, on an index made by RTreeQuantize. If visited is not
+// NULL, the number of visited nodes is added to it.
+MeshIndex FindTriangleQuant(const struct QuantIndex *index,
+                            const struct Mesh *mesh, struct Vertex p,
+                            int *visited);
+
+// Frozen index whose leaves carry the geometry of their triangles: the 2D
+// corners of every entry, stored by lane right after the rects and IDs of
+// the leaf, in the same record (GeomLeaf). A query then tests containment
+// without reading the mesh arrays at all.
+typedef struct {
+  double x[3][FROZEN_LANES]; // x of corner k of the triangle of each entry
+  double y[3][FROZEN_LANES];
+} LeafGeometry;
+
+typedef struct {
+  struct FrozenNode node;
+  LeafGeometry geometry;
+} GeomLeaf;
+
+// The internal nodes stay in index (in the order of the layout, root
+// first); the children of the nodes at level 1 are positions in leaves.
+// If the whole tree is one leaf, index is empty and leaves[0] is the root.
+typedef struct {
+  struct FrozenIndex index;
+  GeomLeaf *leaves;
+  int leafCount;
+} GeomIndex;
+
+// Freezes the tree of root (see RTreeFreeze) and copies the corners of the
+// mesh triangles into its leaves. Returns 1 on success, 0 if out of memory.
+int BuildGeomIndex(struct Node *root, const struct Mesh *mesh,
+                   enum RTreeFreezeLayout layout, GeomIndex *g);
+void FreeGeomIndex(GeomIndex *g);
+
+// Same as FindTriangle, on a GeomIndex: the mesh is not needed.
+// Stops at the first triangle found.
+MeshIndex FindTriangleGeom(const GeomIndex *g, struct Vertex p);
+
+// Frozen index whose leaves are tested with precomputed edge functions
+// (see EdgeTable): leaf i of index uses the FROZEN_LANES rows of table from
+// leafRow[i] on, one per lane, so the overlap mask of the leaf and the
+// containment mask of its triangles are computed side by side.
+typedef struct {
+  struct FrozenIndex index;
+  EdgeTable table;
+  MeshIndex *leafRow; // First row of each node of index, -1 for internal nodes
+} EdgeIndex;
+
+// Freezes the tree of root (see RTreeFreeze) and builds the edge functions
+// of the triangles of its leaves. Returns 1 on success, 0 if out of memory.
+int BuildEdgeIndex(struct Node *root, const struct Mesh *mesh,
+                   enum RTreeFreezeLayout layout, EdgeIndex *e);
+void FreeEdgeIndex(EdgeIndex *e);
+
+// Same as FindTriangle, on an EdgeIndex: the mesh is not needed.
+// Stops at the first triangle found. A point on an edge can be found in the
+// triangle on either side.
+MeshIndex FindTriangleEdge(const EdgeIndex *e, struct Vertex p);
+
+// Triangles overlapping a window (e.g. a tile), without allocation: the
+// candidates of RTreeSearchWindow (triangles whose box overlaps the window)
+// are filtered in place by an exact triangle/box overlap test, and the
+// indices of the triangles kept are written to out_ids[0..capacity-1].
+// Returns the number written. *needed (may be NULL) receives the number of
+// triangles overlapping the window if they all fit; if the candidates did
+// not, it receives the number of candidates instead, which is larger than
+// capacity: call again with a buffer of that size.
+MeshIndex FindTrianglesInWindow(struct Node *root, const struct Mesh *mesh,
+                                struct Rect *window, MeshIndex *out_ids,
+                                MeshIndex capacity, MeshIndex *needed);
+
+// Part of a segment inside a triangle: the segment goes from a (t = 0) to
+// b (t = 1) and is inside the triangle for t in [tEnter, tExit]
+typedef struct {
+  MeshIndex triangle;
+  MeshIndex segment; // Segment of the polyline (0 for a single segment)
+  double tEnter, tExit;
+} SegmentHit;
+
+// Every triangle crossed by the segment ab, sorted along it (by tEnter,
+// then tExit): branches are pruned with a slab test of the segment against
+// their rect, and the segment is clipped exactly by the three edges of the
+// triangles of the leaves reached. A segment that only touches a triangle
+// gets tEnter == tExit; degenerate triangles are never crossed.
+// Writes up to capacity hits and returns how many; *needed (may be NULL)
+// receives the number of triangles crossed. If that is more than capacity,
+// the hits written are not the first ones along the segment: call again
+// with a buffer of *needed entries.
+MeshIndex FindTrianglesOnSegment(struct Node *root, const struct Mesh *mesh,
+                                 double ax, double ay, double bx, double by,
+                                 SegmentHit *hits, MeshIndex capacity,
+                                 MeshIndex *needed);
+
+// Same as FindTrianglesOnSegment for each segment of the polyline of the
+// npoints points, one after the other: the hits of segment i (SegmentHit
+// segment == i, t along that segment) follow the hits of segment i - 1.
+// *needed receives the total for the whole polyline.
+MeshIndex FindTrianglesOnPolyline(struct Node *root, const struct Mesh *mesh,
+                                  const struct Vertex *points,
+                                  MeshIndex npoints, SegmentHit *hits,
+                                  MeshIndex capacity, MeshIndex *needed);
+
+// Clips the segment ab to triangle tri: returns 1 and the part inside in
+// [*t0, *t1] if the segment crosses or touches the triangle, 0 otherwise.
+int ClipSegmentToTriangle(const struct Mesh *mesh, MeshIndex tri, double ax,
+                          double ay, double bx, double by, double *t0,
+                          double *t1);
+
+// Pairs of overlapping triangles of two meshes indexed by rootA and rootB
+// (e.g. to remap a field from one onto the other), as triangle indices
+// (pair.a in meshA, pair.b in meshB), by a synchronized traversal of both
+// trees (RTreeJoin). The candidates are the pairs whose boxes overlap; with
+// exact, only the pairs of triangles that overlap or touch are kept
+// (separating axis test). Same buffer convention as FindTrianglesInWindow:
+// returns the number of pairs written, and *needed (may be NULL) is larger
+// than capacity if the buffer was too small.
+MeshIndex JoinMeshes(struct Node *rootA, const struct Mesh *meshA,
+                     struct Node *rootB, const struct Mesh *meshB, int exact,
+                     struct RTreePair *pairs, MeshIndex capacity,
+                     MeshIndex *needed);
+
+// Same pairs in the same order as JoinMeshes, on the threads of pool: the
+// pairs of overlapping branches under the two roots are joined as separate
+// tasks (shared with work stealing, see ThreadPoolRunChunks), each into its
+// own buffer, and the results are concatenated. Returns -1 if out of memory
+// (nothing is written then).
+MeshIndex JoinMeshesParallel(ThreadPool *pool, struct Node *rootA,
+                             const struct Mesh *meshA, struct Node *rootB,
+                             const struct Mesh *meshB, int exact,
+                             struct RTreePair *pairs, MeshIndex capacity,
+                             MeshIndex *needed);
+
+// Same as FindTriangle, also adds the number of visited nodes to *visited.
+MeshIndex FindTriangleVisits(struct Node *root, const struct Mesh *mesh,
+                             struct Vertex p, int *visited);
 
 int IsPointInTriangle(struct Vertex p, struct Vertex a, struct Vertex b,
                       struct Vertex c);
 
+// The test RTreeLocatePoint applies to each triangle: 1 if (x, y) lies in
+// triangle tri of the mesh or on its boundary.
+int PointInMeshTriangle(const struct Mesh *mesh, MeshIndex tri, double x,
+                        double y);
+
 #endif
@@ -0,0 +1,43 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+// Task run by every thread of a pool: thread is in [0, nthreads).
+typedef void (*ThreadTask)(void *arg, int thread, int nthreads);
+
+typedef struct ThreadPool ThreadPool;
+
+// Starts a pool of nthreads threads (the calling thread counts as thread 0,
+// so nthreads - 1 workers are created). Workers stay alive between runs.
+// If a worker cannot be started, the pool keeps the threads started before
+// it (see ThreadPoolSize). Returns NULL if out of memory.
+ThreadPool *ThreadPoolCreate(int nthreads);
+
+// Runs task(arg, t, nthreads) on every thread t of the pool and waits until
+// all of them are done.
+void ThreadPoolRun(ThreadPool *pool, ThreadTask task, void *arg);
+
+// Task of ThreadPoolRunChunks: runs chunk number chunk on thread.
+typedef void (*ChunkTask)(void *arg, unsigned int chunk, int thread);
+
+// Runs task on chunks 0 to nchunks - 1, spread over the threads of the pool
+// with work stealing: every thread starts with an equal share of
+// consecutive chunks and runs it in order; a thread that runs out takes the
+// back half of what is left of the share of another thread. Chunks should
+// be small enough to balance the load and large enough to amortize the
+// scheduling (a few microseconds of work). Waits until all chunks are done.
+void ThreadPoolRunChunks(ThreadPool *pool, ChunkTask task, void *arg,
+                         unsigned int nchunks);
+
+// Chunks that thread took from other threads during the last
+// ThreadPoolRunChunks.
+unsigned int ThreadPoolStolenChunks(const ThreadPool *pool, int thread);
+
+int ThreadPoolSize(const ThreadPool *pool);
+
+// Stops and joins the workers.
+void ThreadPoolDestroy(ThreadPool *pool);
+
+// Number of online cores (at least 1).
+int GetNumCores(void);
+
+#endif
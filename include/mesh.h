@@ -2,6 +2,19 @@
 
 #pragma once
 
+/* Type of the vertex and triangle indices and counts. 32-bit by default;
+ * with RTREE_64BIT_IDS (the same switch as the 64-bit IDs of the R-Tree,
+ * see RTreeId in Index.h) meshes can have more than 2^31 - 1 elements.
+ * MESH_INDEX_FMT is the matching printf/scanf conversion.
+ */
+#ifdef RTREE_64BIT_IDS
+typedef long long MeshIndex;
+#define MESH_INDEX_FMT "%lld"
+#else
+typedef int MeshIndex;
+#define MESH_INDEX_FMT "%d"
+#endif
+
 /* The Vertex structure, just a triple of double precision floating point
  * numbers which correspond to the coordinates of the vertex in a given
  * reference frame.
@@ -21,9 +34,9 @@ struct Vertex {
 struct Triangle {
   union {
     struct {
-      int v1, v2, v3;
+      MeshIndex v1, v2, v3;
     };
-    int idx[3];
+    MeshIndex idx[3];
   };
 };
 
@@ -31,8 +44,8 @@ struct Triangle {
  * of triangles, a pointer to the vertices and a pointer to the triangles.
  */
 struct Mesh {
-  int nvert;
-  int ntri;
+  MeshIndex nvert;
+  MeshIndex ntri;
   struct Vertex *vertices;
   struct Triangle *triangles;
 };
@@ -0,0 +1,141 @@
+#include "../include/EdgeTable.h"
+#include <stdlib.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Never-inside rows after the last one, so that a vector block starting on
+// any row can be loaded whole (its lanes past the range are masked out)
+#define EDGE_TABLE_PAD 4
+
+// Row r: edge functions of triangle t, or never-inside ones if t < 0
+static void SetEdgeRow(EdgeTable *table, MeshIndex r, const struct Mesh *mesh,
+                       MeshIndex t) {
+  const struct Vertex *v[3];
+  double area = 0;
+
+  if (t >= 0) {
+    for (int k = 0; k < 3; k++)
+      v[k] = &mesh->vertices[mesh->triangles[t].idx[k]];
+    area = (v[1]->x - v[0]->x) * (v[2]->y - v[0]->y) -
+           (v[1]->y - v[0]->y) * (v[2]->x - v[0]->x);
+  }
+  for (int k = 0; k < 3; k++) {
+    if (area == 0) { // 0 * x + 0 * y - 1 < 0 everywhere
+      table->a[k][r] = 0;
+      table->b[k][r] = 0;
+      table->c[k][r] = -1;
+      continue;
+    }
+    // Left of the edge for a counter-clockwise triangle, right otherwise
+    const struct Vertex *p = v[k], *q = v[(k + 1) % 3];
+    double s = area > 0 ? 1 : -1;
+    double dx = q->x - p->x, dy = q->y - p->y;
+    table->a[k][r] = -dy * s;
+    table->b[k][r] = dx * s;
+    table->c[k][r] = (dy * p->x - dx * p->y) * s;
+  }
+}
+
+int BuildEdgeTable(const struct Mesh *mesh, const MeshIndex *triangles,
+                   MeshIndex rows, EdgeTable *table) {
+  int ok = 1;
+
+  if (!triangles)
+    rows = mesh->ntri;
+  size_t n = (size_t)rows + EDGE_TABLE_PAD;
+  table->rows = rows;
+  for (int k = 0; k < 3; k++) {
+    if (posix_memalign((void **)&table->a[k], 64, sizeof(double) * n) != 0)
+      table->a[k] = NULL, ok = 0;
+    if (posix_memalign((void **)&table->b[k], 64, sizeof(double) * n) != 0)
+      table->b[k] = NULL, ok = 0;
+    if (posix_memalign((void **)&table->c[k], 64, sizeof(double) * n) != 0)
+      table->c[k] = NULL, ok = 0;
+  }
+  table->triangle = malloc(sizeof(MeshIndex) * n);
+  if (!ok || !table->triangle) {
+    FreeEdgeTable(table);
+    return 0;
+  }
+
+  for (MeshIndex r = 0; r < (MeshIndex)n; r++) {
+    MeshIndex t = r >= rows ? -1 : triangles ? triangles[r] : r;
+    table->triangle[r] = t;
+    SetEdgeRow(table, r, mesh, t);
+  }
+  return 1;
+}
+
+void FreeEdgeTable(EdgeTable *table) {
+  for (int k = 0; k < 3; k++) {
+    free(table->a[k]);
+    free(table->b[k]);
+    free(table->c[k]);
+    table->a[k] = table->b[k] = table->c[k] = NULL;
+  }
+  free(table->triangle);
+  table->triangle = NULL;
+  table->rows = 0;
+}
+
+unsigned int EdgeTableMask(const EdgeTable *table, MeshIndex first, int count,
+                           double x, double y) {
+  unsigned int mask = 0;
+  int i;
+
+#if defined(__AVX__)
+  __m256d px = _mm256_set1_pd(x), py = _mm256_set1_pd(y);
+  __m256d zero = _mm256_setzero_pd();
+  for (i = 0; i < count; i += 4) {
+    __m256d in = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    for (int k = 0; k < 3; k++) {
+      __m256d e = _mm256_add_pd(
+          _mm256_add_pd(
+              _mm256_mul_pd(_mm256_loadu_pd(&table->a[k][first + i]), px),
+              _mm256_mul_pd(_mm256_loadu_pd(&table->b[k][first + i]), py)),
+          _mm256_loadu_pd(&table->c[k][first + i]));
+      in = _mm256_and_pd(in, _mm256_cmp_pd(e, zero, _CMP_GE_OQ));
+    }
+    mask |= (unsigned int)_mm256_movemask_pd(in) << i;
+  }
+#elif defined(__SSE2__)
+  __m128d px = _mm_set1_pd(x), py = _mm_set1_pd(y);
+  __m128d zero = _mm_setzero_pd();
+  for (i = 0; i < count; i += 2) {
+    __m128d in = _mm_castsi128_pd(_mm_set1_epi32(-1));
+    for (int k = 0; k < 3; k++) {
+      __m128d e = _mm_add_pd(
+          _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(&table->a[k][first + i]), px),
+                     _mm_mul_pd(_mm_loadu_pd(&table->b[k][first + i]), py)),
+          _mm_loadu_pd(&table->c[k][first + i]));
+      in = _mm_and_pd(in, _mm_cmpge_pd(e, zero));
+    }
+    mask |= (unsigned int)_mm_movemask_pd(in) << i;
+  }
+#else
+  for (i = 0; i < count; i++) {
+    int in = 1;
+    for (int k = 0; k < 3; k++)
+      in &= table->a[k][first + i] * x + table->b[k][first + i] * y +
+                table->c[k][first + i] >=
+            0;
+    mask |= (unsigned int)in << i;
+  }
+#endif
+  // Lanes of the last block past count
+  return count < 32 ? mask & ((1u << count) - 1) : mask;
+}
+
+MeshIndex EdgeTableFind(const EdgeTable *table, MeshIndex first,
+                        MeshIndex count, double x, double y) {
+  for (MeshIndex i = 0; i < count; i += 32) {
+    int block = count - i < 32 ? (int)(count - i) : 32;
+    unsigned int mask = EdgeTableMask(table, first + i, block, x, y);
+    if (mask)
+      return first + i + __builtin_ctz(mask);
+  }
+  return -1;
+}
@@ -9,7 +9,7 @@ void ExportMeshToGnuplot(const struct Mesh *mesh, const char *filename) {
     return;
   }
 
-  for (int i = 0; i < mesh->ntri; i++) {
+  for (MeshIndex i = 0; i < mesh->ntri; i++) {
     struct Triangle t = mesh->triangles[i];
     struct Vertex p1 = mesh->vertices[t.v1];
     struct Vertex p2 = mesh->vertices[t.v2];
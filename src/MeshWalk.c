@@ -0,0 +1,143 @@
+#include "../include/MeshWalk.h"
+#include "../include/RTreeWrapper.h"
+#include <stdlib.h>
+
+// Edge of a triangle, with its end points sorted so that both triangles
+// sharing it produce the same (a, b)
+typedef struct {
+  MeshIndex a, b;
+  MeshIndex slot; // 3 * triangle + edge
+} MeshEdge;
+
+static int CompareEdges(const void *A, const void *B) {
+  const MeshEdge *x = (const MeshEdge *)A;
+  const MeshEdge *y = (const MeshEdge *)B;
+  if (x->a != y->a)
+    return (x->a > y->a) - (x->a < y->a);
+  return (x->b > y->b) - (x->b < y->b);
+}
+
+int BuildMeshAdjacency(const struct Mesh *mesh, MeshAdjacency *adj) {
+  MeshIndex nslots = 3 * mesh->ntri;
+  MeshEdge *edges = malloc(sizeof(MeshEdge) * (nslots > 0 ? nslots : 1));
+
+  adj->ntri = mesh->ntri;
+  adj->neighbors = malloc(sizeof(MeshIndex) * (nslots > 0 ? nslots : 1));
+  if (!edges || !adj->neighbors) {
+    free(edges);
+    FreeMeshAdjacency(adj);
+    return 0;
+  }
+
+  for (MeshIndex t = 0; t < mesh->ntri; t++) {
+    for (int k = 0; k < 3; k++) {
+      MeshIndex u = mesh->triangles[t].idx[k];
+      MeshIndex v = mesh->triangles[t].idx[(k + 1) % 3];
+      MeshEdge *e = &edges[3 * t + k];
+      e->a = u < v ? u : v;
+      e->b = u < v ? v : u;
+      e->slot = 3 * t + k;
+      adj->neighbors[3 * t + k] = -1;
+    }
+  }
+  qsort(edges, nslots, sizeof(MeshEdge), CompareEdges);
+
+  // Equal edges are now next to each other; pair them two by two (an edge
+  // shared by more than two triangles keeps some of them unpaired)
+  for (MeshIndex i = 0; i + 1 < nslots; i++) {
+    if (edges[i].a == edges[i + 1].a && edges[i].b == edges[i + 1].b) {
+      adj->neighbors[edges[i].slot] = edges[i + 1].slot / 3;
+      adj->neighbors[edges[i + 1].slot] = edges[i].slot / 3;
+      i++;
+    }
+  }
+  free(edges);
+  return 1;
+}
+
+void FreeMeshAdjacency(MeshAdjacency *adj) {
+  free(adj->neighbors);
+  adj->neighbors = NULL;
+  adj->ntri = 0;
+}
+
+// Twice the signed area of (a, b, (x, y)): positive if the point is on the
+// left of a -> b
+static double Orient(const struct Vertex *a, const struct Vertex *b, double x,
+                     double y) {
+  return (b->x - a->x) * (y - a->y) - (b->y - a->y) * (x - a->x);
+}
+
+// Triangle to start from without a hint: the first entry containing the
+// point in the first leaf reached by always following the first branch
+// that contains it (one root-to-leaf path, no backtracking). -1 if the
+// path ends before a leaf.
+static MeshIndex WalkStart(struct Node *root, double x, double y) {
+  struct Rect r;
+  struct Node *n = root;
+
+  r.boundary[0] = x;
+  r.boundary[1] = y;
+  r.boundary[2] = x;
+  r.boundary[3] = y;
+  for (;;) {
+    int i = 0;
+    while (i < n->count && !RTreeOverlap(&r, &n->branch[i].rect))
+      i++;
+    if (i == n->count)
+      return -1;
+    if (n->level == 0)
+      return n->branch[i].id - 1;
+    n = n->branch[i].child;
+  }
+}
+
+MeshIndex WalkLocatePoint(const MeshAdjacency *adj, struct Node *root,
+                          const struct Mesh *mesh, double x, double y,
+                          MeshIndex hint, WalkStats *stats) {
+  MeshIndex t = (hint >= 0 && hint < mesh->ntri) ? hint
+                                                  : WalkStart(root, x, y);
+  MeshIndex from = -1;
+  int steps = 0;
+
+  if (stats)
+    stats->queries++;
+  while (t >= 0 && steps <= WALK_MAX_STEPS) {
+    const struct Triangle *tr = &mesh->triangles[t];
+    const struct Vertex *v[3] = {&mesh->vertices[tr->v1],
+                                 &mesh->vertices[tr->v2],
+                                 &mesh->vertices[tr->v3]};
+    double area = Orient(v[0], v[1], v[2]->x, v[2]->y);
+    int k;
+
+    if (area == 0) // Degenerate triangle, no inside to walk towards
+      break;
+    // First edge with the point strictly on the other side (the edge we
+    // came through has the point on this side already)
+    for (k = 0; k < 3; k++) {
+      MeshIndex nb = adj->neighbors[3 * t + k];
+      if (nb >= 0 && nb == from)
+        continue;
+      if (Orient(v[k], v[(k + 1) % 3], x, y) * area < 0)
+        break;
+    }
+    if (k == 3) {
+      // Inside or on the boundary; confirmed with the test of the fallback,
+      // so that the walk finds a triangle exactly when RTreeLocatePoint does
+      if (!PointInMeshTriangle(mesh, t, x, y))
+        break;
+      if (stats)
+        stats->steps += steps;
+      return t;
+    }
+    from = t;
+    t = adj->neighbors[3 * t + k]; // -1: the walk leaves the mesh
+    steps++;
+  }
+
+  if (stats) {
+    stats->steps += steps;
+    stats->fallbacks++;
+  }
+  return RTreeLocatePoint(root, mesh, x, y);
+}
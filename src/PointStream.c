@@ -0,0 +1,438 @@
+#include "../include/PointStream.h"
+#include "../include/RTreeWrapper.h"
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Bytes of a text output line: triangle and 3 weights, with separators
+#define STREAM_LINE_MAX 64
+// Text read from the input at a time
+#define STREAM_TEXT_CHUNK (1 << 20)
+
+typedef enum { SLOT_FREE, SLOT_READ, SLOT_LOCATED } SlotState;
+
+// One batch, passed from stage to stage
+typedef struct {
+  SlotState state;
+  int last; // No batch after this one
+  MeshIndex count;
+  struct Vertex *points;
+  PointLocation *locations;
+  char *out; // Formatted results
+} StreamSlot;
+
+typedef struct {
+  struct Node *root;
+  const struct Mesh *mesh;
+  const StreamOptions *options;
+  StreamStats *stats;
+  StreamSlot slots[STREAM_SLOTS];
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  int error;
+
+  // Input: a mapped file, or a stream read in chunks
+  FILE *in;
+  const unsigned char *map;
+  size_t mapSize, mapPos;
+  char *text;     // Text not parsed yet (text[textLen] is always 0)
+  size_t textPos, textLen, textCap;
+  int eof;
+  double *raw;    // Binary records read from a stream
+
+  FILE *out;
+} Stream;
+
+static double StreamClock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static StreamSlot *WaitSlot(Stream *s, int k, SlotState state) {
+  pthread_mutex_lock(&s->lock);
+  while (s->slots[k].state != state)
+    pthread_cond_wait(&s->changed, &s->lock);
+  pthread_mutex_unlock(&s->lock);
+  return &s->slots[k];
+}
+
+static void SetSlot(Stream *s, int k, SlotState state) {
+  pthread_mutex_lock(&s->lock);
+  s->slots[k].state = state;
+  pthread_cond_broadcast(&s->changed);
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void StreamError(Stream *s) {
+  pthread_mutex_lock(&s->lock);
+  s->error = 1;
+  pthread_mutex_unlock(&s->lock);
+}
+
+// Refills the text buffer after the unparsed part; returns 0 at the end of
+// the input
+static int ReadText(Stream *s) {
+  if (s->eof)
+    return 0;
+  memmove(s->text, s->text + s->textPos, s->textLen - s->textPos);
+  s->textLen -= s->textPos;
+  s->textPos = 0;
+  if (s->textCap - s->textLen < STREAM_TEXT_CHUNK) { // A very long line
+    char *grown = realloc(s->text, 2 * s->textCap + 1);
+    if (!grown) {
+      StreamError(s);
+      s->eof = 1;
+      return 0;
+    }
+    s->text = grown;
+    s->textCap *= 2;
+  }
+  size_t n = fread(s->text + s->textLen, 1, s->textCap - s->textLen, s->in);
+  if (n == 0) {
+    if (ferror(s->in))
+      StreamError(s);
+    s->eof = 1;
+  }
+  s->textLen += n;
+  s->text[s->textLen] = '\0';
+  return n > 0;
+}
+
+static int IsSeparator(char c) {
+  return c == ' ' || c == '\t' || c == ',' || c == ';' || c == '\r';
+}
+
+// Parses the line [p, end) into *v. Returns 0 for a line to skip, 1 for a
+// point, -1 for a line that is not a point (v is then NaN).
+static int ParseLine(const char *p, const char *end, struct Vertex *v) {
+  char *next;
+
+  while (p < end && IsSeparator(*p))
+    p++;
+  if (p == end || *p == '#')
+    return 0;
+  v->z = 0.0;
+  v->x = strtod(p, &next);
+  if (next == p || next > end)
+    goto bad;
+  p = next;
+  while (p < end && IsSeparator(*p))
+    p++;
+  if (p == end) // strtod would skip the newline and read the next line
+    goto bad;
+  v->y = strtod(p, &next);
+  if (next == p || next > end)
+    goto bad;
+  return 1;
+bad:
+  v->x = v->y = NAN;
+  return -1;
+}
+
+static MeshIndex ReadTextBatch(Stream *s, StreamSlot *slot) {
+  MeshIndex n = 0;
+
+  while (n < STREAM_BATCH) {
+    char *line = s->text + s->textPos;
+    char *nl = memchr(line, '\n', s->textLen - s->textPos);
+    if (!nl) {
+      if (ReadText(s))
+        continue;
+      if (s->textPos == s->textLen)
+        break;
+      // Last line, without a newline (ReadText may have moved it)
+      line = s->text + s->textPos;
+      nl = s->text + s->textLen;
+    }
+    int kind = ParseLine(line, nl, &slot->points[n]);
+    if (kind != 0)
+      n++;
+    if (kind < 0)
+      s->stats->rejected++;
+    s->textPos = (size_t)(nl - s->text) + (nl < s->text + s->textLen);
+  }
+  return n;
+}
+
+static MeshIndex ReadBinaryBatch(Stream *s, StreamSlot *slot) {
+  const unsigned char *records;
+  size_t n;
+
+  if (s->map) {
+    n = (s->mapSize - s->mapPos) / (2 * sizeof(double));
+    if (n > STREAM_BATCH)
+      n = STREAM_BATCH;
+    records = s->map + s->mapPos;
+    s->mapPos += n * 2 * sizeof(double);
+    if (n < STREAM_BATCH && s->mapPos < s->mapSize) {
+      s->stats->rejected++; // Truncated record at the end
+      s->mapPos = s->mapSize;
+    }
+  } else {
+    size_t bytes = 0, want = STREAM_BATCH * 2 * sizeof(double);
+    while (bytes < want) {
+      size_t got = fread((char *)s->raw + bytes, 1, want - bytes, s->in);
+      if (got == 0)
+        break;
+      bytes += got;
+    }
+    if (ferror(s->in))
+      StreamError(s);
+    n = bytes / (2 * sizeof(double));
+    if (bytes % (2 * sizeof(double)))
+      s->stats->rejected++;
+    records = (const unsigned char *)s->raw;
+  }
+  for (size_t i = 0; i < n; i++) {
+    double xy[2];
+    memcpy(xy, records + i * sizeof(xy), sizeof(xy)); // May be unaligned
+    slot->points[i] = (struct Vertex){{{xy[0], xy[1], 0.0}}};
+  }
+  return (MeshIndex)n;
+}
+
+static int StreamInputDone(const Stream *s) {
+  if (s->map)
+    return s->mapPos >= s->mapSize;
+  if (s->options->inputFormat == STREAM_BINARY)
+    return feof(s->in) || ferror(s->in);
+  return s->eof && s->textPos >= s->textLen;
+}
+
+static void *ReaderStage(void *arg) {
+  Stream *s = (Stream *)arg;
+
+  for (int k = 0;; k = (k + 1) % STREAM_SLOTS) {
+    StreamSlot *slot = WaitSlot(s, k, SLOT_FREE);
+    double t0 = StreamClock();
+    slot->count = s->options->inputFormat == STREAM_BINARY
+                      ? ReadBinaryBatch(s, slot)
+                      : ReadTextBatch(s, slot);
+    slot->last = slot->count < STREAM_BATCH || StreamInputDone(s);
+    s->stats->readSeconds += StreamClock() - t0;
+    SetSlot(s, k, SLOT_READ);
+    if (slot->last)
+      return NULL;
+  }
+}
+
+// Writes v >= 0 with 9 decimals at p; returns the end
+static char *FormatWeight(char *p, double v) {
+  long long q = llround((v < 0 ? 0 : v > 1 ? 1 : v) * 1e9);
+
+  *p++ = (char)('0' + q / 1000000000);
+  *p++ = '.';
+  q %= 1000000000;
+  for (int d = 8; d >= 0; d--) {
+    p[d] = (char)('0' + q % 10);
+    q /= 10;
+  }
+  return p + 9;
+}
+
+// Writes the decimal form of i at p; returns the end
+static char *FormatIndex(char *p, MeshIndex i) {
+  char digits[24];
+  int n = 0;
+  unsigned long long u =
+      i < 0 ? 0ULL - (unsigned long long)i : (unsigned long long)i;
+
+  if (i < 0)
+    *p++ = '-';
+  do {
+    digits[n++] = (char)('0' + u % 10);
+    u /= 10;
+  } while (u);
+  while (n > 0)
+    *p++ = digits[--n];
+  return p;
+}
+
+static size_t FormatBatch(const Stream *s, StreamSlot *slot) {
+  int weights = s->options->weights;
+  char *p = slot->out;
+
+  for (MeshIndex i = 0; i < slot->count; i++) {
+    const PointLocation *l = &slot->locations[i];
+    if (s->options->outputFormat == STREAM_BINARY) {
+      memcpy(p, &l->triangle, sizeof(MeshIndex));
+      p += sizeof(MeshIndex);
+      if (weights) {
+        memcpy(p, l->weights, 3 * sizeof(double));
+        p += 3 * sizeof(double);
+      }
+      continue;
+    }
+    p = FormatIndex(p, l->triangle);
+    for (int k = 0; weights && k < 3; k++) {
+      *p++ = ' ';
+      p = FormatWeight(p, l->weights[k]);
+    }
+    *p++ = '\n';
+  }
+  return (size_t)(p - slot->out);
+}
+
+static void *WriterStage(void *arg) {
+  Stream *s = (Stream *)arg;
+
+  for (int k = 0;; k = (k + 1) % STREAM_SLOTS) {
+    StreamSlot *slot = WaitSlot(s, k, SLOT_LOCATED);
+    double t0 = StreamClock();
+    size_t bytes = FormatBatch(s, slot);
+    if (bytes > 0 && fwrite(slot->out, 1, bytes, s->out) != bytes)
+      StreamError(s);
+    s->stats->writeSeconds += StreamClock() - t0;
+    int last = slot->last;
+    SetSlot(s, k, SLOT_FREE);
+    if (last)
+      return NULL;
+  }
+}
+
+// Opens the input; a binary regular file is mapped instead of read
+static int OpenInput(Stream *s) {
+  const char *path = s->options->input;
+
+  if (!path || strcmp(path, "-") == 0) {
+    s->in = stdin;
+  } else if (s->options->inputFormat == STREAM_BINARY) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0)
+      return -1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED) {
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        s->map = map;
+        s->mapSize = st.st_size;
+        close(fd);
+        return 0;
+      }
+    }
+    s->in = fdopen(fd, "rb"); // Empty file, pipe or mmap failure
+    if (!s->in) {
+      close(fd);
+      return -1;
+    }
+  } else {
+    s->in = fopen(path, "r");
+    if (!s->in)
+      return -1;
+  }
+
+  if (s->options->inputFormat == STREAM_BINARY) {
+    s->raw = malloc(STREAM_BATCH * 2 * sizeof(double));
+    return s->raw ? 0 : -1;
+  }
+  s->textCap = 2 * STREAM_TEXT_CHUNK;
+  s->text = malloc(s->textCap + 1);
+  if (!s->text)
+    return -1;
+  s->text[0] = '\0';
+  return 0;
+}
+
+static void CloseInput(Stream *s) {
+  if (s->map)
+    munmap((void *)s->map, s->mapSize);
+  if (s->in && s->in != stdin)
+    fclose(s->in);
+  free(s->text);
+  free(s->raw);
+}
+
+int RunPointStream(ThreadPool *pool, struct Node *root,
+                   const struct Mesh *mesh, const StreamOptions *options,
+                   StreamStats *stats) {
+  Stream s;
+  size_t outBytes = options->outputFormat == STREAM_BINARY
+                        ? sizeof(MeshIndex) + 3 * sizeof(double)
+                        : STREAM_LINE_MAX;
+  int ok = 1;
+
+  memset(&s, 0, sizeof(Stream));
+  memset(stats, 0, sizeof(StreamStats));
+  s.root = root;
+  s.mesh = mesh;
+  s.options = options;
+  s.stats = stats;
+  for (int k = 0; k < STREAM_SLOTS; k++) {
+    StreamSlot *slot = &s.slots[k];
+    slot->points = malloc(sizeof(struct Vertex) * STREAM_BATCH);
+    slot->locations = malloc(sizeof(PointLocation) * STREAM_BATCH);
+    slot->out = malloc(outBytes * STREAM_BATCH);
+    ok &= slot->points && slot->locations && slot->out;
+  }
+  if (!options->output || strcmp(options->output, "-") == 0)
+    s.out = stdout;
+  else
+    s.out = fopen(options->output,
+                  options->outputFormat == STREAM_BINARY ? "wb" : "w");
+  if (!ok || !s.out || OpenInput(&s) != 0) {
+    CloseInput(&s);
+    if (s.out && s.out != stdout)
+      fclose(s.out);
+    for (int k = 0; k < STREAM_SLOTS; k++) {
+      free(s.slots[k].points);
+      free(s.slots[k].locations);
+      free(s.slots[k].out);
+    }
+    return -1;
+  }
+
+  pthread_mutex_init(&s.lock, NULL);
+  pthread_cond_init(&s.changed, NULL);
+  double start = StreamClock();
+  pthread_t reader, writer;
+  pthread_create(&reader, NULL, ReaderStage, &s);
+  pthread_create(&writer, NULL, WriterStage, &s);
+
+  // Locator stage, on the calling thread and the threads of the pool
+  for (int k = 0;; k = (k + 1) % STREAM_SLOTS) {
+    StreamSlot *slot = WaitSlot(&s, k, SLOT_READ);
+    double t0 = StreamClock();
+    if (pool)
+      LocateAndInterpolateParallel(pool, root, mesh, slot->points,
+                                   slot->count, NULL, 0, slot->locations,
+                                   NULL);
+    else
+      LocateAndInterpolate(root, mesh, slot->points, slot->count, NULL, 0,
+                           slot->locations, NULL, BATCH_ORDER_INPUT);
+    for (MeshIndex i = 0; i < slot->count; i++)
+      stats->outside += slot->locations[i].triangle < 0;
+    stats->points += slot->count;
+    stats->locateSeconds += StreamClock() - t0;
+    int last = slot->last;
+    SetSlot(&s, k, SLOT_LOCATED);
+    if (last)
+      break;
+  }
+
+  pthread_join(reader, NULL);
+  pthread_join(writer, NULL);
+  if (fflush(s.out) != 0)
+    s.error = 1;
+  stats->seconds = StreamClock() - start;
+  pthread_cond_destroy(&s.changed);
+  pthread_mutex_destroy(&s.lock);
+
+  CloseInput(&s);
+  if (s.out != stdout)
+    fclose(s.out);
+  for (int k = 0; k < STREAM_SLOTS; k++) {
+    free(s.slots[k].points);
+    free(s.slots[k].locations);
+    free(s.slots[k].out);
+  }
+  return s.error ? -1 : 0;
+}
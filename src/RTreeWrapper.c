@@ -1,18 +1,32 @@
 #include "../include/RTreeWrapper.h"
+#include "../include/ThreadPool.h"
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
 
 // To calculate min/max
 static double min(double a, double b) { return a < b ? a : b; }
 static double max(double a, double b) { return a > b ? a : b; }
 
-// Barycentric coordinate check (2D only, ignores z)
-int IsPointInTriangle(struct Vertex p, struct Vertex a, struct Vertex b,
-                      struct Vertex c) {
-  double v0x = c.x - a.x;
-  double v0y = c.y - a.y;
-  double v1x = b.x - a.x;
-  double v1y = b.y - a.y;
-  double v2x = p.x - a.x;
-  double v2y = p.y - a.y;
+// Barycentric coordinates of point (px, py) in triangle abc (2D): w[0],
+// w[1] and w[2] are the weights of a, b and c. Returns 1 if the point is
+// inside the triangle or on its boundary.
+// Inlined in the point-location fast path; IsPointInTriangle and every
+// locator use this same arithmetic, so all agree on points that lie on an
+// edge. That holds only while no copy fuses the products into FMAs, which is
+// why the native build passes -ffp-contract=off (see CMakeLists.txt).
+static inline int PointBarycentricXY(double px, double py,
+                                     const struct Vertex *a,
+                                     const struct Vertex *b,
+                                     const struct Vertex *c, double w[3]) {
+  double v0x = c->x - a->x;
+  double v0y = c->y - a->y;
+  double v1x = b->x - a->x;
+  double v1y = b->y - a->y;
+  double v2x = px - a->x;
+  double v2y = py - a->y;
 
   double dot00 = v0x * v0x + v0y * v0y;
   double dot01 = v0x * v1x + v0y * v1y;
@@ -21,44 +35,422 @@ int IsPointInTriangle(struct Vertex p, struct Vertex a, struct Vertex b,
   double dot12 = v1x * v2x + v1y * v2y;
 
   double invDenom = 1.0 / (dot00 * dot11 - dot01 * dot01);
-  double u = (dot11 * dot02 - dot01 * dot12) * invDenom;
-  double v = (dot00 * dot12 - dot01 * dot02) * invDenom;
+  double u = (dot11 * dot02 - dot01 * dot12) * invDenom; // Along ac
+  double v = (dot00 * dot12 - dot01 * dot02) * invDenom; // Along ab
 
+  w[0] = 1 - u - v;
+  w[1] = v;
+  w[2] = u;
   return (u >= 0) && (v >= 0) && (u + v <= 1);
 }
 
-struct Node *BuildRTree(const struct Mesh *mesh) {
-  struct Node *root = RTreeNewIndex();
+static inline int PointInTriangleXY(double px, double py,
+                                    const struct Vertex *a,
+                                    const struct Vertex *b,
+                                    const struct Vertex *c) {
+  double w[3];
+  return PointBarycentricXY(px, py, a, b, c, w);
+}
+
+// Barycentric coordinate check (2D only, ignores z)
+int IsPointInTriangle(struct Vertex p, struct Vertex a, struct Vertex b,
+                      struct Vertex c) {
+  return PointInTriangleXY(p.x, p.y, &a, &b, &c);
+}
+
+int PointInMeshTriangle(const struct Mesh *mesh, MeshIndex tri, double x,
+                        double y) {
+  const struct Triangle *t = &mesh->triangles[tri];
+  double w[3];
+  return PointBarycentricXY(x, y, &mesh->vertices[t->v1],
+                            &mesh->vertices[t->v2], &mesh->vertices[t->v3], w);
+}
 
-  for (int i = 0; i < mesh->ntri; i++) {
-    struct Triangle t = mesh->triangles[i];
-    struct Vertex p1 = mesh->vertices[t.v1];
-    struct Vertex p2 = mesh->vertices[t.v2];
-    struct Vertex p3 = mesh->vertices[t.v3];
+// Bounding box of triangle i of the mesh
+static struct Rect TriangleRect(const struct Mesh *mesh, MeshIndex i) {
+  struct Triangle t = mesh->triangles[i];
+  struct Vertex p1 = mesh->vertices[t.v1];
+  struct Vertex p2 = mesh->vertices[t.v2];
+  struct Vertex p3 = mesh->vertices[t.v3];
 
-    struct Rect rect;
-    // Identify min and max for bounding box
-    rect.boundary[0] = min(p1.x, min(p2.x, p3.x)); // xmin
-    rect.boundary[1] = min(p1.y, min(p2.y, p3.y)); // ymin
-    rect.boundary[2] = max(p1.x, max(p2.x, p3.x)); // xmax
-    rect.boundary[3] = max(p1.y, max(p2.y, p3.y)); // ymax
+  struct Rect rect;
+  // Identify min and max for bounding box
+  rect.boundary[0] = min(p1.x, min(p2.x, p3.x)); // xmin
+  rect.boundary[1] = min(p1.y, min(p2.y, p3.y)); // ymin
+  rect.boundary[2] = max(p1.x, max(p2.x, p3.x)); // xmax
+  rect.boundary[3] = max(p1.y, max(p2.y, p3.y)); // ymax
+  return rect;
+}
+
+struct Node *BuildRTree(struct RTreeContext *ctx, const struct Mesh *mesh) {
+  struct Node *root = RTreeNewIndex(ctx);
+
+  for (MeshIndex i = 0; i < mesh->ntri; i++) {
+    struct Rect rect = TriangleRect(mesh, i);
 
     // Insert into RTree. ID must be > 0. using i+1.
-    RTreeInsertRect(&rect, i + 1, &root, 0);
+    RTreeInsertRect(ctx, &rect, i + 1, &root, 0);
   }
   return root;
 }
 
+struct Node *BuildRTreeSTR(struct RTreeContext *ctx, const struct Mesh *mesh) {
+  struct Rect *rects = malloc(sizeof(struct Rect) * mesh->ntri);
+  RTreeId *ids = malloc(sizeof(RTreeId) * mesh->ntri);
+
+  for (MeshIndex i = 0; i < mesh->ntri; i++) {
+    rects[i] = TriangleRect(mesh, i);
+    ids[i] = i + 1; // Same IDs as BuildRTree
+  }
+  struct Node *root = RTreeBulkLoadSTR(ctx, rects, ids, mesh->ntri);
+
+  free(rects);
+  free(ids);
+  return root;
+}
+
+// Position of cell (x, y) along the Hilbert curve filling a 2^16 x 2^16 grid
+static uint32_t HilbertIndex(uint32_t x, uint32_t y) {
+  const uint32_t n = 1u << 16;
+  uint32_t d = 0;
+  for (uint32_t s = n / 2; s > 0; s /= 2) {
+    uint32_t rx = (x & s) > 0;
+    uint32_t ry = (y & s) > 0;
+    d += s * s * ((3 * rx) ^ ry);
+    // Rotate the quadrant so that the sub-curve has the right orientation
+    if (ry == 0) {
+      if (rx == 1) {
+        x = n - 1 - x;
+        y = n - 1 - y;
+      }
+      uint32_t tmp = x;
+      x = y;
+      y = tmp;
+    }
+  }
+  return d;
+}
+
+typedef struct {
+  uint32_t key;
+  MeshIndex tri;
+} HilbertEntry;
+
+static int CompareHilbertEntries(const void *a, const void *b) {
+  uint32_t ka = ((const HilbertEntry *)a)->key;
+  uint32_t kb = ((const HilbertEntry *)b)->key;
+  return (ka > kb) - (ka < kb);
+}
+
+struct Node *BuildRTreeHilbert(struct RTreeContext *ctx,
+                               const struct Mesh *mesh) {
+  MeshIndex n = mesh->ntri;
+  struct Rect *rects = malloc(sizeof(struct Rect) * n);
+  RTreeId *ids = malloc(sizeof(RTreeId) * n);
+  HilbertEntry *order = malloc(sizeof(HilbertEntry) * n);
+
+  // Extent of the triangle centroids, mapped onto the Hilbert grid
+  double minX = 1e300, minY = 1e300, maxX = -1e300, maxY = -1e300;
+  for (int i = 0; i < n; i++) {
+    rects[i] = TriangleRect(mesh, i);
+    double cx = 0.5 * (rects[i].boundary[0] + rects[i].boundary[2]);
+    double cy = 0.5 * (rects[i].boundary[1] + rects[i].boundary[3]);
+    minX = min(minX, cx);
+    maxX = max(maxX, cx);
+    minY = min(minY, cy);
+    maxY = max(maxY, cy);
+  }
+  double sx = (maxX > minX) ? 65535.0 / (maxX - minX) : 0.0;
+  double sy = (maxY > minY) ? 65535.0 / (maxY - minY) : 0.0;
+
+  for (int i = 0; i < n; i++) {
+    double cx = 0.5 * (rects[i].boundary[0] + rects[i].boundary[2]);
+    double cy = 0.5 * (rects[i].boundary[1] + rects[i].boundary[3]);
+    order[i].key =
+        HilbertIndex((uint32_t)((cx - minX) * sx), (uint32_t)((cy - minY) * sy));
+    order[i].tri = i;
+  }
+  qsort(order, n, sizeof(HilbertEntry), CompareHilbertEntries);
+
+  // Reorder the rects along the curve, IDs follow (same IDs as BuildRTree)
+  for (int i = 0; i < n; i++) {
+    ids[i] = order[i].tri + 1;
+    rects[i] = TriangleRect(mesh, order[i].tri);
+  }
+  struct Node *root = RTreeBulkLoadOrdered(ctx, rects, ids, n);
+
+  free(order);
+  free(rects);
+  free(ids);
+  return root;
+}
+
+// Shared state of BuildRTreeParallel. Every phase is one ThreadPoolRun in
+// which thread t works on its own range of triangles, entries or runs.
+typedef struct {
+  struct RTreeContext *threadCtx; // One per thread: nodes of its subtrees
+  const struct Mesh *mesh;
+  MeshIndex n;
+  struct Rect *rects;   // MBR of every triangle, in mesh order
+  double *extent;       // Centroid extent seen by each thread (4 per thread)
+  double minX, minY, sx, sy; // Mapping of the centroids to the Hilbert grid
+  HilbertEntry *order;  // Triangles sorted along the curve
+  HilbertEntry *tmp;    // Merge buffer
+  MeshIndex *runs;      // Boundaries of the sorted runs (nruns + 1)
+  int nruns;
+  struct Branch *branches; // Entries, then packed subtree roots
+  MeshIndex *chunks;       // Entry range of each thread subtree (nthreads + 1)
+  MeshIndex *packed;       // Number of subtree roots built by each thread
+  int topLevel;            // Level of the subtree roots
+} ParallelBuild;
+
+// Start of the share of thread t when n items are split between nthreads
+static MeshIndex ThreadRangeStart(MeshIndex n, int t, int nthreads) {
+  return (MeshIndex)((long long)n * t / nthreads);
+}
+
+static void ParallelRectsTask(void *arg, int t, int nthreads) {
+  ParallelBuild *pb = (ParallelBuild *)arg;
+  int begin = ThreadRangeStart(pb->n, t, nthreads);
+  int end = ThreadRangeStart(pb->n, t + 1, nthreads);
+  double *e = &pb->extent[4 * t];
+
+  e[0] = e[1] = 1e300;
+  e[2] = e[3] = -1e300;
+  for (int i = begin; i < end; i++) {
+    pb->rects[i] = TriangleRect(pb->mesh, i);
+    double cx = 0.5 * (pb->rects[i].boundary[0] + pb->rects[i].boundary[2]);
+    double cy = 0.5 * (pb->rects[i].boundary[1] + pb->rects[i].boundary[3]);
+    e[0] = min(e[0], cx);
+    e[1] = min(e[1], cy);
+    e[2] = max(e[2], cx);
+    e[3] = max(e[3], cy);
+  }
+}
+
+static void ParallelSortTask(void *arg, int t, int nthreads) {
+  ParallelBuild *pb = (ParallelBuild *)arg;
+  int begin = ThreadRangeStart(pb->n, t, nthreads);
+  int end = ThreadRangeStart(pb->n, t + 1, nthreads);
+
+  for (int i = begin; i < end; i++) {
+    double cx = 0.5 * (pb->rects[i].boundary[0] + pb->rects[i].boundary[2]);
+    double cy = 0.5 * (pb->rects[i].boundary[1] + pb->rects[i].boundary[3]);
+    pb->order[i].key = HilbertIndex((uint32_t)((cx - pb->minX) * pb->sx),
+                                    (uint32_t)((cy - pb->minY) * pb->sy));
+    pb->order[i].tri = i;
+  }
+  qsort(pb->order + begin, end - begin, sizeof(HilbertEntry),
+        CompareHilbertEntries);
+}
+
+// One round of pairwise merging: thread t merges runs 2t and 2t+1 into tmp
+// (a trailing odd run is just copied).
+static void ParallelMergeTask(void *arg, int t, int nthreads) {
+  ParallelBuild *pb = (ParallelBuild *)arg;
+  (void)nthreads;
+  if (2 * t >= pb->nruns)
+    return;
+
+  MeshIndex i = pb->runs[2 * t];
+  MeshIndex mid = pb->runs[2 * t + 1];
+  MeshIndex end = (2 * t + 2 <= pb->nruns) ? pb->runs[2 * t + 2] : mid;
+  MeshIndex j = mid, k = i;
+  while (i < mid && j < end)
+    pb->tmp[k++] = (pb->order[j].key < pb->order[i].key) ? pb->order[j++]
+                                                           : pb->order[i++];
+  while (i < mid)
+    pb->tmp[k++] = pb->order[i++];
+  while (j < end)
+    pb->tmp[k++] = pb->order[j++];
+}
+
+// Thread t packs its chunk of consecutive entries into a subtree whose
+// roots are at level topLevel (several roots if the chunk holds several
+// subtrees). Chunks are multiples of a full subtree, so the result is the
+// same as packing the whole level at once.
+static void ParallelPackTask(void *arg, int t, int nthreads) {
+  ParallelBuild *pb = (ParallelBuild *)arg;
+  (void)nthreads;
+  MeshIndex begin = pb->chunks[t];
+  MeshIndex m = pb->chunks[t + 1] - begin;
+  struct Branch *b = pb->branches + begin;
+
+  for (MeshIndex i = 0; i < m; i++) {
+    MeshIndex tri = pb->order[begin + i].tri;
+    b[i].rect = pb->rects[tri];
+    b[i].child = NULL;  // Clears the whole payload
+    b[i].id = tri + 1; // Same IDs as BuildRTree
+  }
+  for (int level = 0; level <= pb->topLevel && m > 0; level++)
+    m = RTreePackLevel(&pb->threadCtx[t], b, m, level);
+  pb->packed[t] = m;
+}
+
+struct Node *BuildRTreeParallel(struct RTreeContext *ctx,
+                                const struct Mesh *mesh, int nthreads) {
+  ParallelBuild pb;
+  MeshIndex n = mesh->ntri;
+
+  if (n <= 0)
+    return RTreeNewIndex(ctx);
+  if (nthreads < 1)
+    nthreads = 1;
+
+  ThreadPool *pool = ThreadPoolCreate(nthreads);
+  if (!pool) // Same tree on this thread
+    return BuildRTreeHilbert(ctx, mesh);
+  nthreads = ThreadPoolSize(pool); // Fewer if threads could not be started
+  pb.threadCtx = malloc(sizeof(struct RTreeContext) * nthreads);
+  for (int t = 0; t < nthreads; t++) {
+    pb.threadCtx[t] = *ctx; // Same cardinalities, separate arena
+    RTreeInitArena(&pb.threadCtx[t].arena, ctx->arena.hugePages);
+  }
+  pb.mesh = mesh;
+  pb.n = n;
+  pb.rects = malloc(sizeof(struct Rect) * n);
+  pb.extent = malloc(sizeof(double) * 4 * nthreads);
+  pb.order = malloc(sizeof(HilbertEntry) * n);
+  pb.tmp = malloc(sizeof(HilbertEntry) * n);
+  pb.runs = malloc(sizeof(MeshIndex) * (nthreads + 1));
+  pb.branches = malloc(sizeof(struct Branch) * n);
+  pb.chunks = malloc(sizeof(MeshIndex) * (nthreads + 1));
+  pb.packed = malloc(sizeof(MeshIndex) * nthreads);
+
+  // 1. Triangle MBRs and extent of their centroids
+  ThreadPoolRun(pool, ParallelRectsTask, &pb);
+  double minX = 1e300, minY = 1e300, maxX = -1e300, maxY = -1e300;
+  for (int t = 0; t < nthreads; t++) {
+    minX = min(minX, pb.extent[4 * t]);
+    minY = min(minY, pb.extent[4 * t + 1]);
+    maxX = max(maxX, pb.extent[4 * t + 2]);
+    maxY = max(maxY, pb.extent[4 * t + 3]);
+  }
+  pb.minX = minX;
+  pb.minY = minY;
+  pb.sx = (maxX > minX) ? 65535.0 / (maxX - minX) : 0.0;
+  pb.sy = (maxY > minY) ? 65535.0 / (maxY - minY) : 0.0;
+
+  // 2. Hilbert keys, each thread sorts its own run...
+  ThreadPoolRun(pool, ParallelSortTask, &pb);
+  pb.nruns = nthreads;
+  for (int t = 0; t <= nthreads; t++)
+    pb.runs[t] = ThreadRangeStart(n, t, nthreads);
+
+  // ...then runs are merged pairwise until one is left
+  while (pb.nruns > 1) {
+    ThreadPoolRun(pool, ParallelMergeTask, &pb);
+    HilbertEntry *swap = pb.order;
+    pb.order = pb.tmp;
+    pb.tmp = swap;
+    int merged = 0;
+    for (int r = 0; r < pb.nruns; r += 2)
+      pb.runs[merged++] = pb.runs[r];
+    pb.runs[merged] = n;
+    pb.nruns = merged;
+  }
+
+  // 3. Spatial partition: consecutive chunks of the curve, made of whole
+  // subtrees of LEAFCARD * NODECARD^topLevel entries, the largest subtrees
+  // that still give every thread at least one of them.
+  long long unit = RTreeGetLeafMax(ctx);
+  pb.topLevel = 0;
+  while (unit * RTreeGetNodeMax(ctx) * nthreads <= n) {
+    unit *= RTreeGetNodeMax(ctx);
+    pb.topLevel++;
+  }
+  MeshIndex units = (MeshIndex)((n + unit - 1) / unit);
+  for (int t = 0; t <= nthreads; t++) {
+    long long start = ThreadRangeStart(units, t, nthreads) * unit;
+    pb.chunks[t] = (MeshIndex)(start < n ? start : n);
+  }
+
+  // 4. Independent subtrees, built concurrently
+  ThreadPoolRun(pool, ParallelPackTask, &pb);
+
+  // 5. Shared upper levels over all the subtree roots, the nodes of the
+  // subtrees now belong to the index (ctx)
+  MeshIndex m = 0;
+  for (int t = 0; t < nthreads; t++) {
+    RTreeArenaMerge(&ctx->arena, &pb.threadCtx[t].arena);
+    memmove(pb.branches + m, pb.branches + pb.chunks[t],
+            sizeof(struct Branch) * pb.packed[t]);
+    m += pb.packed[t];
+  }
+  int level = pb.topLevel + 1;
+  while (m > 1)
+    m = RTreePackLevel(ctx, pb.branches, m, level++);
+  struct Node *root = pb.branches[0].child;
+
+  ThreadPoolDestroy(pool);
+  free(pb.threadCtx);
+  free(pb.rects);
+  free(pb.extent);
+  free(pb.order);
+  free(pb.tmp);
+  free(pb.runs);
+  free(pb.branches);
+  free(pb.chunks);
+  free(pb.packed);
+  return root;
+}
+
+// Area of the intersection of two rectangles (0 if disjoint)
+static double OverlapArea(const struct Rect *a, const struct Rect *b) {
+  double w = min(a->boundary[2], b->boundary[2]) -
+             max(a->boundary[0], b->boundary[0]);
+  double h = min(a->boundary[3], b->boundary[3]) -
+             max(a->boundary[1], b->boundary[1]);
+  return (w > 0 && h > 0) ? w * h : 0.0;
+}
+
+static void AccumulateTreeStats(struct Node *node, TreeStats *stats) {
+  stats->nodes++;
+  if (node->level == 0) {
+    stats->leaves++;
+    stats->entries += node->count;
+  }
+
+  for (int i = 0; i < node->count; i++) {
+    struct Branch *b = &node->branch[i];
+    if (node->level == 1) // b is a leaf
+      stats->leafArea += (b->rect.boundary[2] - b->rect.boundary[0]) *
+                         (b->rect.boundary[3] - b->rect.boundary[1]);
+    if (node->level > 0) {
+      for (int j = i + 1; j < node->count; j++)
+        stats->overlap += OverlapArea(&b->rect, &node->branch[j].rect);
+      AccumulateTreeStats(b->child, stats);
+    }
+  }
+}
+
+void ComputeTreeStats(const struct RTreeContext *ctx, struct Node *root,
+                      TreeStats *stats) {
+  stats->height = root->level + 1;
+  stats->nodes = 0;
+  stats->leaves = 0;
+  stats->entries = 0;
+  stats->leafArea = 0.0;
+  stats->overlap = 0.0;
+  AccumulateTreeStats(root, stats);
+  if (root->level == 0) // a single leaf has no parent branch to measure
+    stats->leafArea = 0.0;
+  stats->leafFill = stats->leaves
+                        ? (double)stats->entries /
+                              ((double)stats->leaves * RTreeGetLeafMax(ctx))
+                        : 0.0;
+}
+
 // Callback context
 typedef struct {
   const struct Mesh *mesh;
   struct Vertex p;
-  int foundIndex;
+  MeshIndex foundIndex;
 } SearchContext;
 
-int SearchCallback(int id, void *arg) {
+int SearchCallback(RTreeId id, void *arg) {
   SearchContext *ctx = (SearchContext *)arg;
-  int triIndex = id - 1; // Convert back to 0-based
+  MeshIndex triIndex = id - 1; // Convert back to 0-based
 
   struct Triangle t = ctx->mesh->triangles[triIndex];
   struct Vertex p1 = ctx->mesh->vertices[t.v1];
@@ -72,7 +464,14 @@ int SearchCallback(int id, void *arg) {
   return 1; // Continue search
 }
 
-int FindTriangle(struct Node *root, const struct Mesh *mesh, struct Vertex p) {
+static MeshIndex FingerSearch(struct Node *root, const struct Mesh *mesh,
+                              double x, double y, LocateCursor *cursor);
+
+MeshIndex FindTriangle(struct Node *root, const struct Mesh *mesh,
+                       struct Vertex p, LocateCursor *cursor) {
+  if (cursor && root->level < RTREE_MAX_HEIGHT)
+    return FingerSearch(root, mesh, p.x, p.y, cursor);
+
   struct Rect searchRect;
   // Degenerate rect (point)
   searchRect.boundary[0] = p.x;
@@ -89,3 +488,1233 @@ int FindTriangle(struct Node *root, const struct Mesh *mesh, struct Vertex p) {
 
   return ctx.foundIndex;
 }
+
+MeshIndex FindTriangleFrozen(const struct FrozenIndex *index,
+                             const struct Mesh *mesh, struct Vertex p) {
+  struct Rect searchRect;
+  searchRect.boundary[0] = p.x;
+  searchRect.boundary[1] = p.y;
+  searchRect.boundary[2] = p.x;
+  searchRect.boundary[3] = p.y;
+
+  SearchContext ctx;
+  ctx.mesh = mesh;
+  ctx.p = p;
+  ctx.foundIndex = -1;
+
+  RTreeFrozenSearch(index, &searchRect, SearchCallback, &ctx);
+  return ctx.foundIndex;
+}
+
+MeshIndex FindTriangleQuant(const struct QuantIndex *index,
+                            const struct Mesh *mesh, struct Vertex p,
+                            int *visited) {
+  struct Rect searchRect;
+  searchRect.boundary[0] = p.x;
+  searchRect.boundary[1] = p.y;
+  searchRect.boundary[2] = p.x;
+  searchRect.boundary[3] = p.y;
+
+  SearchContext ctx;
+  ctx.mesh = mesh;
+  ctx.p = p;
+  ctx.foundIndex = -1;
+
+  RTreeQuantSearch(index, &searchRect, SearchCallback, &ctx, visited);
+  return ctx.foundIndex;
+}
+
+int BuildGeomIndex(struct Node *root, const struct Mesh *mesh,
+                   enum RTreeFreezeLayout layout, GeomIndex *g) {
+  struct FrozenIndex frozen;
+
+  if (!RTreeFreeze(root, layout, &frozen))
+    return 0;
+
+  // New positions: leaves and internal nodes numbered apart, each in the
+  // order of the frozen array (so the root stays first)
+  int nodes = frozen.nodeCount, internal = 0;
+  int *slot = malloc(sizeof(int) * nodes);
+  g->leafCount = 0;
+  for (int i = 0; slot && i < nodes; i++)
+    slot[i] = frozen.nodes[i].level == 0 ? g->leafCount++ : internal++;
+  g->index.nodeCount = internal;
+  g->index.nodes = NULL;
+  g->leaves = NULL;
+  if (slot && posix_memalign((void **)&g->index.nodes, 64,
+                             sizeof(struct FrozenNode) *
+                                 (internal > 0 ? internal : 1)) != 0)
+    g->index.nodes = NULL;
+  if (slot && posix_memalign((void **)&g->leaves, 64,
+                             sizeof(GeomLeaf) * g->leafCount) != 0)
+    g->leaves = NULL;
+  if (!slot || !g->index.nodes || !g->leaves) {
+    free(slot);
+    RTreeFreeFrozen(&frozen);
+    FreeGeomIndex(g);
+    return 0;
+  }
+
+  for (int i = 0; i < nodes; i++) {
+    const struct FrozenNode *n = &frozen.nodes[i];
+    if (n->level > 0) {
+      struct FrozenNode *copy = &g->index.nodes[slot[i]];
+      *copy = *n;
+      for (int j = 0; j < n->count; j++)
+        copy->child[j] = slot[n->child[j]];
+      continue;
+    }
+    GeomLeaf *leaf = &g->leaves[slot[i]];
+    leaf->node = *n;
+    memset(&leaf->geometry, 0, sizeof(LeafGeometry));
+    for (int j = 0; j < n->count; j++) {
+      const struct Triangle *t = &mesh->triangles[n->child[j] - 1];
+      for (int k = 0; k < 3; k++) {
+        leaf->geometry.x[k][j] = mesh->vertices[t->idx[k]].x;
+        leaf->geometry.y[k][j] = mesh->vertices[t->idx[k]].y;
+      }
+    }
+  }
+  free(slot);
+  RTreeFreeFrozen(&frozen);
+  return 1;
+}
+
+void FreeGeomIndex(GeomIndex *g) {
+  RTreeFreeFrozen(&g->index);
+  free(g->leaves);
+  g->leaves = NULL;
+  g->leafCount = 0;
+}
+
+// Entry of a GeomLeaf whose triangle contains p, or -1.
+static MeshIndex GeomSearchLeaf(const GeomLeaf *leaf, struct Rect *r,
+                                struct Vertex p) {
+  const LeafGeometry *geom = &leaf->geometry;
+  unsigned int mask = RTreeFrozenOverlapMask(&leaf->node, r);
+
+  for (int i = 0; mask; i++, mask >>= 1) {
+    if (!(mask & 1))
+      continue;
+    struct Vertex a = {{{geom->x[0][i], geom->y[0][i], 0.0}}};
+    struct Vertex b = {{{geom->x[1][i], geom->y[1][i], 0.0}}};
+    struct Vertex c = {{{geom->x[2][i], geom->y[2][i], 0.0}}};
+    if (IsPointInTriangle(p, a, b, c))
+      return leaf->node.child[i] - 1;
+  }
+  return -1;
+}
+
+// Depth first search of p on a GeomIndex. Returns the triangle index, or -1.
+static MeshIndex GeomSearch(const GeomIndex *g, int pos, struct Rect *r,
+                            struct Vertex p) {
+  const struct FrozenNode *n = &g->index.nodes[pos];
+  unsigned int mask = RTreeFrozenOverlapMask(n, r);
+
+  for (int i = 0; mask; i++, mask >>= 1) {
+    if (!(mask & 1))
+      continue;
+    MeshIndex found = n->level > 1
+                          ? GeomSearch(g, (int)n->child[i], r, p)
+                          : GeomSearchLeaf(&g->leaves[n->child[i]], r, p);
+    if (found >= 0)
+      return found;
+  }
+  return -1;
+}
+
+MeshIndex FindTriangleGeom(const GeomIndex *g, struct Vertex p) {
+  struct Rect searchRect;
+  searchRect.boundary[0] = p.x;
+  searchRect.boundary[1] = p.y;
+  searchRect.boundary[2] = p.x;
+  searchRect.boundary[3] = p.y;
+
+  if (g->index.nodeCount == 0) // A single leaf
+    return GeomSearchLeaf(&g->leaves[0], &searchRect, p);
+  return GeomSearch(g, 0, &searchRect, p);
+}
+
+int BuildEdgeIndex(struct Node *root, const struct Mesh *mesh,
+                   enum RTreeFreezeLayout layout, EdgeIndex *e) {
+  if (!RTreeFreeze(root, layout, &e->index))
+    return 0;
+
+  // One block of FROZEN_LANES rows per leaf, in the order of the array,
+  // -1 in the lanes past the count of the leaf
+  int nodes = e->index.nodeCount;
+  MeshIndex rows = 0;
+  e->leafRow = malloc(sizeof(MeshIndex) * nodes);
+  for (int i = 0; e->leafRow && i < nodes; i++) {
+    e->leafRow[i] = e->index.nodes[i].level == 0 ? rows : -1;
+    if (e->index.nodes[i].level == 0)
+      rows += FROZEN_LANES;
+  }
+  MeshIndex *triangles = malloc(sizeof(MeshIndex) * (rows > 0 ? rows : 1));
+  if (!e->leafRow || !triangles) {
+    free(triangles);
+    free(e->leafRow);
+    e->leafRow = NULL;
+    RTreeFreeFrozen(&e->index);
+    return 0;
+  }
+  for (int i = 0; i < nodes; i++) {
+    const struct FrozenNode *n = &e->index.nodes[i];
+    if (n->level > 0)
+      continue;
+    for (int j = 0; j < FROZEN_LANES; j++)
+      triangles[e->leafRow[i] + j] = j < n->count ? n->child[j] - 1 : -1;
+  }
+
+  int ok = BuildEdgeTable(mesh, triangles, rows, &e->table);
+  free(triangles);
+  if (!ok) {
+    free(e->leafRow);
+    e->leafRow = NULL;
+    RTreeFreeFrozen(&e->index);
+  }
+  return ok;
+}
+
+void FreeEdgeIndex(EdgeIndex *e) {
+  RTreeFreeFrozen(&e->index);
+  FreeEdgeTable(&e->table);
+  free(e->leafRow);
+  e->leafRow = NULL;
+}
+
+// Depth first search of p on an EdgeIndex. Returns the triangle index, or -1.
+static MeshIndex EdgeSearch(const EdgeIndex *e, int pos, struct Rect *r,
+                            struct Vertex p) {
+  const struct FrozenNode *n = &e->index.nodes[pos];
+  unsigned int mask = RTreeFrozenOverlapMask(n, r);
+
+  if (n->level == 0) {
+    // Only the vector blocks of rows whose box holds the point, in row
+    // order, up to the first hit (the same answer as the other searches)
+    MeshIndex row = e->leafRow[pos];
+    while (mask) {
+      int first = __builtin_ctz(mask) & ~(EDGE_TABLE_BLOCK - 1);
+      unsigned int hit =
+          mask & EdgeTableMask(&e->table, row + first, EDGE_TABLE_BLOCK, p.x,
+                               p.y)
+                     << first;
+      if (hit)
+        return e->table.triangle[row + __builtin_ctz(hit)];
+      mask &= ~(((1u << EDGE_TABLE_BLOCK) - 1) << first);
+    }
+    return -1;
+  }
+  for (int i = 0; mask; i++, mask >>= 1) {
+    if (!(mask & 1))
+      continue;
+    MeshIndex found = EdgeSearch(e, (int)n->child[i], r, p);
+    if (found >= 0)
+      return found;
+  }
+  return -1;
+}
+
+MeshIndex FindTriangleEdge(const EdgeIndex *e, struct Vertex p) {
+  struct Rect searchRect;
+  searchRect.boundary[0] = p.x;
+  searchRect.boundary[1] = p.y;
+  searchRect.boundary[2] = p.x;
+  searchRect.boundary[3] = p.y;
+
+  return EdgeSearch(e, 0, &searchRect, p);
+}
+
+// Point in a branch rect, as RTreeOverlap of the degenerate rect of the
+// point (coordinates rounded to RectReal the same way).
+static inline int PointInRect(const struct Rect *r, RectReal x, RectReal y) {
+#if NUMDIMS == 2
+  return r->boundary[0] <= x && x <= r->boundary[2] && r->boundary[1] <= y &&
+         y <= r->boundary[3];
+#else
+  // Remaining coordinates of the point are 0
+  for (int d = 2; d < NUMDIMS; d++)
+    if (r->boundary[d] > 0 || 0 > r->boundary[d + NUMDIMS])
+      return 0;
+  return r->boundary[0] <= x && x <= r->boundary[NUMDIMS] &&
+         r->boundary[1] <= y && y <= r->boundary[1 + NUMDIMS];
+#endif
+}
+
+// RTreeLocatePoint, also returning the barycentric weights of the point in
+// the triangle found
+static MeshIndex LocatePointWeights(struct Node *root, const struct Mesh *mesh,
+                                    double x, double y, double w[3]) {
+  // Pending subtrees; a node pushes at most count - 1 more than it pops
+  struct Node *stack[RTREE_MAX_HEIGHT * MAXCARD];
+  RectReal rx = (RectReal)x, ry = (RectReal)y;
+  int top = 0;
+
+  if (root->level >= RTREE_MAX_HEIGHT) { // Too high for the stack
+    struct Vertex p = {{{x, y, 0.0}}};
+    MeshIndex tri = FindTriangle(root, mesh, p, NULL);
+    if (tri >= 0) {
+      const struct Triangle *t = &mesh->triangles[tri];
+      PointBarycentricXY(x, y, &mesh->vertices[t->v1], &mesh->vertices[t->v2],
+                         &mesh->vertices[t->v3], w);
+    }
+    return tri;
+  }
+  stack[top++] = root;
+  while (top > 0) {
+    struct Node *n = stack[--top];
+
+    if (n->level > 0) {
+      // Pushed last to first, so that children are visited in branch order
+      // (the order of RTreeSearch, hence the same first hit as FindTriangle)
+      for (int i = n->count - 1; i >= 0; i--)
+        if (PointInRect(&n->branch[i].rect, rx, ry))
+          stack[top++] = n->branch[i].child;
+      continue;
+    }
+    for (int i = 0; i < n->count; i++) {
+      if (!PointInRect(&n->branch[i].rect, rx, ry))
+        continue;
+      MeshIndex tri = n->branch[i].id - 1;
+      const struct Triangle *t = &mesh->triangles[tri];
+      if (PointBarycentricXY(x, y, &mesh->vertices[t->v1],
+                             &mesh->vertices[t->v2], &mesh->vertices[t->v3],
+                             w))
+        return tri;
+    }
+  }
+  return -1;
+}
+
+MeshIndex RTreeLocatePoint(struct Node *root, const struct Mesh *mesh,
+                           double x, double y) {
+  double w[3];
+  return LocatePointWeights(root, mesh, x, y, w);
+}
+
+void InitLocateCursor(LocateCursor *cursor) {
+  memset(cursor, 0, sizeof(LocateCursor));
+}
+
+// Tests the entries of a leaf but skip (-1 for none) and records the one
+// containing the point in the cursor.
+static MeshIndex CursorScanLeaf(struct Node *leaf, const struct Mesh *mesh,
+                                double x, double y, int skip,
+                                LocateCursor *cursor) {
+  RectReal rx = (RectReal)x, ry = (RectReal)y;
+
+  for (int i = 0; i < leaf->count; i++) {
+    if (i == skip || !PointInRect(&leaf->branch[i].rect, rx, ry))
+      continue;
+    MeshIndex tri = leaf->branch[i].id - 1;
+    const struct Triangle *t = &mesh->triangles[tri];
+    if (PointInTriangleXY(x, y, &mesh->vertices[t->v1],
+                          &mesh->vertices[t->v2], &mesh->vertices[t->v3])) {
+      cursor->entry = i;
+      return tri;
+    }
+  }
+  return -1;
+}
+
+// Searches the subtree of n, at depth d of the path, but its branch skip
+// (-1 for none), recording the path to the answer in the cursor.
+static MeshIndex CursorDescend(struct Node *n, int d, int skip,
+                               const struct Mesh *mesh, double x, double y,
+                               LocateCursor *cursor) {
+  RectReal rx = (RectReal)x, ry = (RectReal)y;
+
+  cursor->path[d] = n;
+  if (n->level == 0) {
+    MeshIndex tri = CursorScanLeaf(n, mesh, x, y, skip, cursor);
+    if (tri != -1)
+      cursor->depth = d;
+    return tri;
+  }
+  for (int i = 0; i < n->count; i++) {
+    if (i == skip || !PointInRect(&n->branch[i].rect, rx, ry))
+      continue;
+    cursor->slot[d] = i;
+    MeshIndex tri =
+        CursorDescend(n->branch[i].child, d + 1, -1, mesh, x, y, cursor);
+    if (tri != -1)
+      return tri;
+  }
+  return -1;
+}
+
+static MeshIndex FingerSearch(struct Node *root, const struct Mesh *mesh,
+                              double x, double y, LocateCursor *cursor) {
+  MeshIndex tri;
+
+  if (cursor->root != root) { // No path yet, or into another tree
+    cursor->root = root;
+    cursor->depth = -1;
+  }
+  if (cursor->depth < 0) {
+    tri = CursorDescend(root, 0, -1, mesh, x, y, cursor);
+    if (tri == -1) {
+      cursor->depth = -1;
+      cursor->missed++;
+    } else {
+      cursor->climbed++;
+    }
+    return tri;
+  }
+
+  // Previous triangle first, then the other entries of its leaf
+  RectReal rx = (RectReal)x, ry = (RectReal)y;
+  struct Node *leaf = cursor->path[cursor->depth];
+  int previous = cursor->entry;
+  if (PointInRect(&leaf->branch[previous].rect, rx, ry)) {
+    const struct Triangle *t =
+        &mesh->triangles[leaf->branch[previous].id - 1];
+    if (PointInTriangleXY(x, y, &mesh->vertices[t->v1],
+                          &mesh->vertices[t->v2], &mesh->vertices[t->v3])) {
+      cursor->sameTriangle++;
+      return leaf->branch[previous].id - 1;
+    }
+  }
+  tri = CursorScanLeaf(leaf, mesh, x, y, previous, cursor);
+  if (tri != -1) {
+    cursor->sameLeaf++;
+    return tri;
+  }
+
+  // Up the path: the subtree of every ancestor whose MBR contains the
+  // point, but the child already searched. A failed search only rewrites
+  // the path below the ancestor, the levels above stay valid.
+  for (int d = cursor->depth - 1; d >= 0; d--) {
+    if (d > 0 &&
+        !PointInRect(&cursor->path[d - 1]->branch[cursor->slot[d - 1]].rect,
+                     rx, ry))
+      continue;
+    tri = CursorDescend(cursor->path[d], d, cursor->slot[d], mesh, x, y,
+                        cursor);
+    if (tri != -1) {
+      cursor->climbed++;
+      return tri;
+    }
+  }
+  cursor->depth = -1; // Path partly rewritten, start from the root next time
+  cursor->missed++;
+  return -1;
+}
+
+// Squared distance from (x, y) to the segment ab
+static double SegmentDist2(double x, double y, const struct Vertex *a,
+                           const struct Vertex *b) {
+  double dx = b->x - a->x, dy = b->y - a->y;
+  double len2 = dx * dx + dy * dy;
+  double t = len2 > 0 ? ((x - a->x) * dx + (y - a->y) * dy) / len2 : 0;
+  t = t < 0 ? 0 : t > 1 ? 1 : t;
+  double ex = a->x + t * dx - x, ey = a->y + t * dy - y;
+  return ex * ex + ey * ey;
+}
+
+// Squared distance from (x, y) to triangle tri: 0 inside, else to the
+// closest edge
+static double TriangleDist2(const struct Mesh *mesh, MeshIndex tri, double x,
+                            double y) {
+  const struct Triangle *t = &mesh->triangles[tri];
+  const struct Vertex *a = &mesh->vertices[t->v1];
+  const struct Vertex *b = &mesh->vertices[t->v2];
+  const struct Vertex *c = &mesh->vertices[t->v3];
+
+  if (PointInTriangleXY(x, y, a, b, c))
+    return 0;
+  return min(SegmentDist2(x, y, a, b),
+             min(SegmentDist2(x, y, b, c), SegmentDist2(x, y, c, a)));
+}
+
+double PointTriangleDistance(const struct Mesh *mesh, MeshIndex tri,
+                             double x, double y) {
+  return sqrt(TriangleDist2(mesh, tri, x, y));
+}
+
+// Squared MINDIST from (x, y) to a branch rect. The rect is widened by one
+// float rounding on each side: the boxes of the triangles are rounded to
+// RectReal and can be slightly smaller than the triangles, and MINDIST must
+// never exceed the distance to anything inside.
+static double RectDist2(const struct Rect *r, double x, double y) {
+  double p[2] = {x, y}, dist2 = 0;
+
+  for (int d = 0; d < 2; d++) {
+    double lo = r->boundary[d], hi = r->boundary[d + NUMDIMS];
+    lo -= fabs(lo) * FLT_EPSILON;
+    hi += fabs(hi) * FLT_EPSILON;
+    double e = p[d] < lo ? lo - p[d] : p[d] > hi ? p[d] - hi : 0;
+    dist2 += e * e;
+  }
+  return dist2;
+}
+
+// Entry of the best-first queue: a node (tri < 0) keyed by the MINDIST of
+// its rect, or a triangle keyed by its exact distance (both squared)
+typedef struct {
+  double key;
+  struct Node *node;
+  MeshIndex tri;
+} NearestEntry;
+
+typedef struct {
+  NearestEntry *entries;
+  int count, capacity;
+  NearestEntry local[NEAREST_QUEUE_LOCAL]; // Until it has to grow
+} NearestQueue;
+
+static int NearestPush(NearestQueue *q, double key, struct Node *node,
+                       MeshIndex tri) {
+  if (q->count == q->capacity) {
+    int capacity = 2 * q->capacity;
+    NearestEntry *grown = malloc(sizeof(NearestEntry) * capacity);
+    if (!grown)
+      return 0;
+    memcpy(grown, q->entries, sizeof(NearestEntry) * q->count);
+    if (q->entries != q->local)
+      free(q->entries);
+    q->entries = grown;
+    q->capacity = capacity;
+  }
+  // Binary min-heap, sift up
+  int i = q->count++;
+  while (i > 0 && q->entries[(i - 1) / 2].key > key) {
+    q->entries[i] = q->entries[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  q->entries[i] = (NearestEntry){key, node, tri};
+  return 1;
+}
+
+static NearestEntry NearestPop(NearestQueue *q) {
+  NearestEntry top = q->entries[0];
+  NearestEntry last = q->entries[--q->count];
+  int i = 0;
+
+  for (;;) { // Sift down
+    int c = 2 * i + 1;
+    if (c >= q->count)
+      break;
+    if (c + 1 < q->count && q->entries[c + 1].key < q->entries[c].key)
+      c++;
+    if (last.key <= q->entries[c].key)
+      break;
+    q->entries[i] = q->entries[c];
+    i = c;
+  }
+  q->entries[i] = last;
+  return top;
+}
+
+int RTreeNearestTriangle(struct Node *root, const struct Mesh *mesh, double x,
+                         double y, int k, MeshIndex *ids, double *dist) {
+  NearestQueue q;
+  int found = 0;
+
+  q.entries = q.local;
+  q.count = 0;
+  q.capacity = NEAREST_QUEUE_LOCAL;
+  if (k <= 0 || !NearestPush(&q, 0, root, -1))
+    return 0;
+
+  // A triangle popped from the queue is closer than every rect and triangle
+  // left in it, so the triangles come out in increasing distance
+  while (q.count > 0 && found < k) {
+    NearestEntry e = NearestPop(&q);
+    if (e.tri >= 0) {
+      ids[found] = e.tri;
+      if (dist)
+        dist[found] = sqrt(e.key);
+      found++;
+      continue;
+    }
+    struct Node *n = e.node;
+    for (int i = 0; i < n->count; i++) {
+      const struct Branch *b = &n->branch[i];
+      int pushed;
+      if (n->level > 0)
+        pushed = NearestPush(&q, RectDist2(&b->rect, x, y), b->child, -1);
+      else
+        pushed = NearestPush(&q, TriangleDist2(mesh, b->id - 1, x, y), NULL,
+                             b->id - 1);
+      if (!pushed) { // Out of memory: what was found so far
+        q.count = 0;
+        break;
+      }
+    }
+  }
+  if (q.entries != q.local)
+    free(q.entries);
+  return found;
+}
+
+// Spreads the 16 low bits of v to the even bit positions
+static uint32_t MortonSpread(uint32_t v) {
+  v &= 0xFFFF;
+  v = (v | (v << 8)) & 0x00FF00FF;
+  v = (v | (v << 4)) & 0x0F0F0F0F;
+  v = (v | (v << 2)) & 0x33333333;
+  v = (v | (v << 1)) & 0x55555555;
+  return v;
+}
+
+// Position of cell (x, y) along the Z-order curve of a 2^16 x 2^16 grid
+static uint32_t MortonIndex(uint32_t x, uint32_t y) {
+  return MortonSpread(x) | (MortonSpread(y) << 1);
+}
+
+typedef struct {
+  uint32_t key;
+  MeshIndex point;
+} MortonEntry;
+
+static int CompareMortonEntries(const void *a, const void *b) {
+  uint32_t ka = ((const MortonEntry *)a)->key;
+  uint32_t kb = ((const MortonEntry *)b)->key;
+  return (ka > kb) - (ka < kb);
+}
+
+// Points 0 to n - 1 sorted along the Z-order curve of a 2^16 x 2^16 grid
+// over their extent, NULL if out of memory. To be freed by the caller.
+static MortonEntry *MortonOrder(const struct Vertex *points, MeshIndex n) {
+  MortonEntry *sorted = malloc(sizeof(MortonEntry) * n);
+  if (!sorted)
+    return NULL;
+
+  double minX = 1e300, minY = 1e300, maxX = -1e300, maxY = -1e300;
+  for (MeshIndex i = 0; i < n; i++) {
+    minX = min(minX, points[i].x);
+    maxX = max(maxX, points[i].x);
+    minY = min(minY, points[i].y);
+    maxY = max(maxY, points[i].y);
+  }
+  double sx = (maxX > minX) ? 65535.0 / (maxX - minX) : 0.0;
+  double sy = (maxY > minY) ? 65535.0 / (maxY - minY) : 0.0;
+  for (MeshIndex i = 0; i < n; i++) {
+    sorted[i].key = MortonIndex((uint32_t)((points[i].x - minX) * sx),
+                                (uint32_t)((points[i].y - minY) * sy));
+    sorted[i].point = i;
+  }
+  qsort(sorted, n, sizeof(MortonEntry), CompareMortonEntries);
+  return sorted;
+}
+
+void FindTrianglesBatch(struct Node *root, const struct Mesh *mesh,
+                        const struct Vertex *points, MeshIndex n,
+                        MeshIndex *out_ids, BatchOrder order) {
+  MortonEntry *sorted = NULL;
+
+  if (order == BATCH_ORDER_MORTON && n > 1)
+    sorted = MortonOrder(points, n);
+  if (!sorted) { // Input order (also the fallback if out of memory)
+    for (MeshIndex i = 0; i < n; i++)
+      out_ids[i] = RTreeLocatePoint(root, mesh, points[i].x, points[i].y);
+    return;
+  }
+
+  // Consecutive queries now walk down mostly the same nodes; results are
+  // scattered back to the position of their point
+  for (MeshIndex i = 0; i < n; i++) {
+    const struct Vertex *p = &points[sorted[i].point];
+    out_ids[sorted[i].point] = RTreeLocatePoint(root, mesh, p->x, p->y);
+  }
+  free(sorted);
+}
+
+// Locates one point and interpolates the fields at it (NaN outside)
+static void LocateAndInterpolatePoint(struct Node *root,
+                                      const struct Mesh *mesh,
+                                      const struct Vertex *p,
+                                      const VertexField *fields, int nfields,
+                                      PointLocation *location,
+                                      double *values) {
+  MeshIndex tri = LocatePointWeights(root, mesh, p->x, p->y,
+                                     location->weights);
+
+  location->triangle = tri;
+  if (tri < 0)
+    location->weights[0] = location->weights[1] = location->weights[2] = 0;
+  for (int f = 0; f < nfields; f++) {
+    const VertexField *field = &fields[f];
+    for (int c = 0; c < field->components; c++) {
+      double value = NAN;
+      if (tri >= 0) {
+        value = 0;
+        for (int k = 0; k < 3; k++)
+          value += location->weights[k] *
+                   field->values[mesh->triangles[tri].idx[k] *
+                                     field->components +
+                                 c];
+      }
+      *values++ = value;
+    }
+  }
+}
+
+void LocateAndInterpolate(struct Node *root, const struct Mesh *mesh,
+                          const struct Vertex *points, MeshIndex n,
+                          const VertexField *fields, int nfields,
+                          PointLocation *locations, double *out_values,
+                          BatchOrder order) {
+  MortonEntry *sorted = NULL;
+  int stride = 0;
+
+  for (int f = 0; f < nfields; f++)
+    stride += fields[f].components;
+  if (order == BATCH_ORDER_MORTON && n > 1)
+    sorted = MortonOrder(points, n);
+  for (MeshIndex i = 0; i < n; i++) {
+    MeshIndex q = sorted ? sorted[i].point : i;
+    LocateAndInterpolatePoint(root, mesh, &points[q], fields, nfields,
+                              &locations[q],
+                              out_values ? out_values + q * stride : NULL);
+  }
+  free(sorted);
+}
+
+// Shared, read-only state of FindTrianglesParallel. Chunk c covers queries
+// c * BATCH_CHUNK to (c + 1) * BATCH_CHUNK - 1 of the run order, and its
+// results go to the same slice of results: every chunk writes its own
+// slice, and every thread its own stats.
+typedef struct {
+  struct Node *root;
+  const struct Mesh *mesh;
+  const struct Vertex *points;
+  const MortonEntry *sorted; // Run order, NULL for the input order
+  MeshIndex n;
+  MeshIndex *results; // Triangle of each query, in run order
+  BatchThreadStats *stats;
+} ParallelBatch;
+
+static void LocateChunkTask(void *arg, unsigned int chunk, int thread) {
+  const ParallelBatch *pb = (const ParallelBatch *)arg;
+  MeshIndex begin = (MeshIndex)chunk * BATCH_CHUNK;
+  MeshIndex end = begin + BATCH_CHUNK < pb->n ? begin + BATCH_CHUNK : pb->n;
+  long long hits = 0;
+
+  for (MeshIndex i = begin; i < end; i++) {
+    const struct Vertex *p =
+        &pb->points[pb->sorted ? pb->sorted[i].point : i];
+    MeshIndex tri = RTreeLocatePoint(pb->root, pb->mesh, p->x, p->y);
+    pb->results[i] = tri;
+    hits += tri != -1;
+  }
+  pb->stats[thread].queries += end - begin;
+  pb->stats[thread].hits += hits;
+}
+
+void FindTrianglesParallel(ThreadPool *pool, struct Node *root,
+                           const struct Mesh *mesh,
+                           const struct Vertex *points, MeshIndex n,
+                           MeshIndex *out_ids, BatchOrder order,
+                           BatchThreadStats *stats) {
+  int nthreads = ThreadPoolSize(pool);
+  ParallelBatch pb;
+  BatchThreadStats *own = NULL;
+
+  pb.root = root;
+  pb.mesh = mesh;
+  pb.points = points;
+  pb.n = n;
+  pb.sorted = NULL;
+  pb.results = out_ids;
+  if (order == BATCH_ORDER_MORTON && n > 1) {
+    MortonEntry *sorted = MortonOrder(points, n);
+    MeshIndex *results = malloc(sizeof(MeshIndex) * n);
+    if (sorted && results) {
+      pb.sorted = sorted;
+      pb.results = results;
+    } else { // Out of memory: input order
+      free(sorted);
+      free(results);
+    }
+  }
+  if (!stats) {
+    if (posix_memalign((void **)&own, 64,
+                       sizeof(BatchThreadStats) * nthreads) != 0)
+      own = NULL;
+    stats = own;
+  }
+  if (!stats) { // Out of memory
+    FindTrianglesBatch(root, mesh, points, n, out_ids, BATCH_ORDER_INPUT);
+    free((void *)pb.sorted);
+    if (pb.results != out_ids)
+      free(pb.results);
+    return;
+  }
+  memset(stats, 0, sizeof(BatchThreadStats) * nthreads);
+  pb.stats = stats;
+
+  ThreadPoolRunChunks(pool, LocateChunkTask, &pb,
+                      (unsigned int)((n + BATCH_CHUNK - 1) / BATCH_CHUNK));
+  for (int t = 0; t < nthreads; t++)
+    stats[t].stolen = ThreadPoolStolenChunks(pool, t);
+
+  // Back to the input order
+  if (pb.sorted) {
+    for (MeshIndex i = 0; i < n; i++)
+      out_ids[pb.sorted[i].point] = pb.results[i];
+    free((void *)pb.sorted);
+    free(pb.results);
+  }
+  free(own);
+}
+
+// Shared, read-only state of LocateAndInterpolateParallel; chunk c covers
+// points c * BATCH_CHUNK to (c + 1) * BATCH_CHUNK - 1, in input order
+typedef struct {
+  struct Node *root;
+  const struct Mesh *mesh;
+  const struct Vertex *points;
+  MeshIndex n;
+  const VertexField *fields;
+  int nfields, stride;
+  PointLocation *locations;
+  double *values;
+} ParallelInterpolation;
+
+static void InterpolateChunkTask(void *arg, unsigned int chunk, int thread) {
+  const ParallelInterpolation *pi = (const ParallelInterpolation *)arg;
+  MeshIndex begin = (MeshIndex)chunk * BATCH_CHUNK;
+  MeshIndex end = begin + BATCH_CHUNK < pi->n ? begin + BATCH_CHUNK : pi->n;
+
+  (void)thread;
+  for (MeshIndex i = begin; i < end; i++)
+    LocateAndInterpolatePoint(pi->root, pi->mesh, &pi->points[i], pi->fields,
+                              pi->nfields, &pi->locations[i],
+                              pi->values ? pi->values + i * pi->stride
+                                         : NULL);
+}
+
+void LocateAndInterpolateParallel(ThreadPool *pool, struct Node *root,
+                                  const struct Mesh *mesh,
+                                  const struct Vertex *points, MeshIndex n,
+                                  const VertexField *fields, int nfields,
+                                  PointLocation *locations,
+                                  double *out_values) {
+  ParallelInterpolation pi;
+
+  pi.root = root;
+  pi.mesh = mesh;
+  pi.points = points;
+  pi.n = n;
+  pi.fields = fields;
+  pi.nfields = nfields;
+  pi.stride = 0;
+  for (int f = 0; f < nfields; f++)
+    pi.stride += fields[f].components;
+  pi.locations = locations;
+  pi.values = out_values;
+  ThreadPoolRunChunks(pool, InterpolateChunkTask, &pi,
+                      (unsigned int)((n + BATCH_CHUNK - 1) / BATCH_CHUNK));
+}
+
+int ClipSegmentToTriangle(const struct Mesh *mesh, MeshIndex tri, double ax,
+                          double ay, double bx, double by, double *t0,
+                          double *t1) {
+  const struct Triangle *t = &mesh->triangles[tri];
+  const struct Vertex *v[3] = {&mesh->vertices[t->v1],
+                               &mesh->vertices[t->v2],
+                               &mesh->vertices[t->v3]};
+  double area = (v[1]->x - v[0]->x) * (v[2]->y - v[0]->y) -
+                (v[1]->y - v[0]->y) * (v[2]->x - v[0]->x);
+  double lo = 0, hi = 1;
+
+  if (area == 0)
+    return 0;
+  // The inner side of edge k is E_k >= 0; E_k is linear along the segment,
+  // from ea at a to eb at b (Cyrus-Beck clipping)
+  for (int k = 0; k < 3 && lo <= hi; k++) {
+    const struct Vertex *p = v[k], *q = v[(k + 1) % 3];
+    double dx = q->x - p->x, dy = q->y - p->y;
+    double ea = (dx * (ay - p->y) - dy * (ax - p->x)) * area;
+    double eb = (dx * (by - p->y) - dy * (bx - p->x)) * area;
+    if (ea == eb) {
+      if (ea < 0)
+        return 0; // Parallel to the edge, outside
+    } else if (eb > ea) {
+      lo = max(lo, ea / (ea - eb)); // Entering
+    } else {
+      hi = min(hi, ea / (ea - eb)); // Leaving
+    }
+  }
+  if (lo > hi)
+    return 0;
+  *t0 = lo;
+  *t1 = hi;
+  return 1;
+}
+
+// Slab test of the segment a + t * (b - a), t in [0, 1], against a branch
+// rect widened by one float rounding (see RectDist2)
+static int SegmentOverlapsRect(const struct Rect *r, const double a[2],
+                               const double d[2]) {
+  double lo = 0, hi = 1;
+
+  for (int k = 0; k < 2; k++) {
+    double rmin = r->boundary[k], rmax = r->boundary[k + NUMDIMS];
+    rmin -= fabs(rmin) * FLT_EPSILON;
+    rmax += fabs(rmax) * FLT_EPSILON;
+    if (d[k] == 0) {
+      if (a[k] < rmin || a[k] > rmax)
+        return 0;
+      continue;
+    }
+    double t0 = (rmin - a[k]) / d[k], t1 = (rmax - a[k]) / d[k];
+    if (t0 > t1) {
+      double swap = t0;
+      t0 = t1;
+      t1 = swap;
+    }
+    lo = max(lo, t0);
+    hi = min(hi, t1);
+    if (lo > hi)
+      return 0;
+  }
+  return 1;
+}
+
+static int CompareSegmentHits(const void *A, const void *B) {
+  const SegmentHit *x = (const SegmentHit *)A;
+  const SegmentHit *y = (const SegmentHit *)B;
+  if (x->tEnter != y->tEnter)
+    return (x->tEnter > y->tEnter) - (x->tEnter < y->tEnter);
+  if (x->tExit != y->tExit)
+    return (x->tExit > y->tExit) - (x->tExit < y->tExit);
+  return (x->triangle > y->triangle) - (x->triangle < y->triangle);
+}
+
+// Clips the segment ab (b = a + d) to the triangles of the entries of leaf
+// n that it crosses the rects of, appending the hits (the first capacity of
+// them) at hits[*found]
+static void SegmentLeafHits(struct Node *n, const struct Mesh *mesh,
+                            const double a[2], const double b[2],
+                            const double d[2], SegmentHit *hits,
+                            MeshIndex capacity, MeshIndex *found) {
+  for (int i = 0; i < n->count; i++) {
+    if (!SegmentOverlapsRect(&n->branch[i].rect, a, d))
+      continue;
+    MeshIndex tri = n->branch[i].id - 1;
+    double t0, t1;
+    if (!ClipSegmentToTriangle(mesh, tri, a[0], a[1], b[0], b[1], &t0, &t1))
+      continue;
+    if (*found < capacity)
+      hits[*found] = (SegmentHit){tri, 0, t0, t1};
+    (*found)++;
+  }
+}
+
+// Recursive walk of FindTrianglesOnSegment, for trees too high for its stack
+static void SegmentHits2(struct Node *n, const struct Mesh *mesh,
+                         const double a[2], const double b[2],
+                         const double d[2], SegmentHit *hits,
+                         MeshIndex capacity, MeshIndex *found) {
+  if (n->level == 0) {
+    SegmentLeafHits(n, mesh, a, b, d, hits, capacity, found);
+    return;
+  }
+  for (int i = 0; i < n->count; i++)
+    if (SegmentOverlapsRect(&n->branch[i].rect, a, d))
+      SegmentHits2(n->branch[i].child, mesh, a, b, d, hits, capacity, found);
+}
+
+MeshIndex FindTrianglesOnSegment(struct Node *root, const struct Mesh *mesh,
+                                 double ax, double ay, double bx, double by,
+                                 SegmentHit *hits, MeshIndex capacity,
+                                 MeshIndex *needed) {
+  // Pending subtrees; a node pushes at most count - 1 more than it pops
+  struct Node *stack[RTREE_MAX_HEIGHT * MAXCARD];
+  double a[2] = {ax, ay}, b[2] = {bx, by}, d[2] = {bx - ax, by - ay};
+  MeshIndex found = 0;
+  int top = 0;
+
+  if (root->level >= RTREE_MAX_HEIGHT)
+    SegmentHits2(root, mesh, a, b, d, hits, capacity, &found);
+  else
+    stack[top++] = root;
+  while (top > 0) {
+    struct Node *n = stack[--top];
+
+    if (n->level == 0) {
+      SegmentLeafHits(n, mesh, a, b, d, hits, capacity, &found);
+      continue;
+    }
+    for (int i = 0; i < n->count; i++)
+      if (SegmentOverlapsRect(&n->branch[i].rect, a, d))
+        stack[top++] = n->branch[i].child;
+  }
+  if (needed)
+    *needed = found;
+  found = found < capacity ? found : capacity;
+  if (found > 1)
+    qsort(hits, found, sizeof(SegmentHit), CompareSegmentHits);
+  return found;
+}
+
+MeshIndex FindTrianglesOnPolyline(struct Node *root, const struct Mesh *mesh,
+                                  const struct Vertex *points,
+                                  MeshIndex npoints, SegmentHit *hits,
+                                  MeshIndex capacity, MeshIndex *needed) {
+  MeshIndex written = 0, total = 0;
+
+  for (MeshIndex s = 0; s + 1 < npoints; s++) {
+    MeshIndex segmentNeeded;
+    MeshIndex n = FindTrianglesOnSegment(
+        root, mesh, points[s].x, points[s].y, points[s + 1].x,
+        points[s + 1].y, hits + written, capacity - written, &segmentNeeded);
+    for (MeshIndex i = 0; i < n; i++)
+      hits[written + i].segment = s;
+    written += n;
+    total += segmentNeeded;
+  }
+  if (needed)
+    *needed = total;
+  return written;
+}
+
+// The window buffer is filled with RTree IDs, then rewritten in place
+typedef char MeshIndexIsRTreeId[sizeof(MeshIndex) == sizeof(RTreeId) ? 1 : -1];
+
+// Exact overlap of triangle tri and a closed box (separating axis test: the
+// box of the triangle, then the three edges of the triangle)
+static int TriangleOverlapsBox(const struct Mesh *mesh, MeshIndex tri,
+                               double xmin, double ymin, double xmax,
+                               double ymax) {
+  const struct Triangle *t = &mesh->triangles[tri];
+  const struct Vertex *v[3] = {&mesh->vertices[t->v1],
+                               &mesh->vertices[t->v2],
+                               &mesh->vertices[t->v3]};
+
+  if (max(v[0]->x, max(v[1]->x, v[2]->x)) < xmin ||
+      min(v[0]->x, min(v[1]->x, v[2]->x)) > xmax ||
+      max(v[0]->y, max(v[1]->y, v[2]->y)) < ymin ||
+      min(v[0]->y, min(v[1]->y, v[2]->y)) > ymax)
+    return 0;
+  double area = (v[1]->x - v[0]->x) * (v[2]->y - v[0]->y) -
+                (v[1]->y - v[0]->y) * (v[2]->x - v[0]->x);
+  if (area == 0) // Degenerate: its box is as close as it gets
+    return 1;
+
+  double cx[4] = {xmin, xmax, xmax, xmin}, cy[4] = {ymin, ymin, ymax, ymax};
+  for (int k = 0; k < 3; k++) {
+    const struct Vertex *a = v[k], *b = v[(k + 1) % 3];
+    double dx = b->x - a->x, dy = b->y - a->y;
+    int c;
+    // Some corner of the box on the inner side of the edge, or on it
+    for (c = 0; c < 4; c++)
+      if ((dx * (cy[c] - a->y) - dy * (cx[c] - a->x)) * area >= 0)
+        break;
+    if (c == 4)
+      return 0;
+  }
+  return 1;
+}
+
+MeshIndex FindTrianglesInWindow(struct Node *root, const struct Mesh *mesh,
+                                struct Rect *window, MeshIndex *out_ids,
+                                MeshIndex capacity, MeshIndex *needed) {
+  RTreeId candidates;
+  MeshIndex n =
+      RTreeSearchWindow(root, window, (RTreeId *)out_ids, capacity, &candidates);
+  MeshIndex kept = 0;
+
+  for (MeshIndex i = 0; i < n; i++) {
+    MeshIndex tri = out_ids[i] - 1;
+    if (TriangleOverlapsBox(mesh, tri, window->boundary[0],
+                            window->boundary[1], window->boundary[NUMDIMS],
+                            window->boundary[1 + NUMDIMS]))
+      out_ids[kept++] = tri;
+  }
+  if (needed)
+    *needed = candidates > capacity ? candidates : kept;
+  return kept;
+}
+
+// Closed overlap of triangles s and t (separating axis test on the edges of
+// both; degenerate triangles are compared by their boxes)
+static int TrianglesOverlap(const struct Mesh *ms, MeshIndex s,
+                            const struct Mesh *mt, MeshIndex t) {
+  const struct Vertex *v[2][3];
+  double area[2];
+
+  for (int k = 0; k < 3; k++) {
+    v[0][k] = &ms->vertices[ms->triangles[s].idx[k]];
+    v[1][k] = &mt->vertices[mt->triangles[t].idx[k]];
+  }
+  for (int m = 0; m < 2; m++)
+    area[m] = (v[m][1]->x - v[m][0]->x) * (v[m][2]->y - v[m][0]->y) -
+              (v[m][1]->y - v[m][0]->y) * (v[m][2]->x - v[m][0]->x);
+  if (area[0] == 0 || area[1] == 0) {
+    double box[2][4];
+    for (int m = 0; m < 2; m++) {
+      box[m][0] = min(v[m][0]->x, min(v[m][1]->x, v[m][2]->x));
+      box[m][1] = min(v[m][0]->y, min(v[m][1]->y, v[m][2]->y));
+      box[m][2] = max(v[m][0]->x, max(v[m][1]->x, v[m][2]->x));
+      box[m][3] = max(v[m][0]->y, max(v[m][1]->y, v[m][2]->y));
+    }
+    return box[0][0] <= box[1][2] && box[1][0] <= box[0][2] &&
+           box[0][1] <= box[1][3] && box[1][1] <= box[0][3];
+  }
+
+  for (int m = 0; m < 2; m++) {
+    for (int k = 0; k < 3; k++) {
+      const struct Vertex *a = v[m][k], *b = v[m][(k + 1) % 3];
+      double dx = b->x - a->x, dy = b->y - a->y;
+      int c;
+      // Some corner of the other triangle on the inner side of the edge
+      for (c = 0; c < 3; c++) {
+        const struct Vertex *p = v[1 - m][c];
+        if ((dx * (p->y - a->y) - dy * (p->x - a->x)) * area[m] >= 0)
+          break;
+      }
+      if (c == 3)
+        return 0;
+    }
+  }
+  return 1;
+}
+
+// Turns the IDs of n pairs into triangle indices and keeps, if exact, only
+// the pairs of triangles that overlap. Returns the number kept.
+static MeshIndex FilterPairs(const struct Mesh *meshA, const struct Mesh *meshB,
+                             int exact, struct RTreePair *pairs, MeshIndex n) {
+  MeshIndex kept = 0;
+
+  for (MeshIndex i = 0; i < n; i++) {
+    struct RTreePair p = {pairs[i].a - 1, pairs[i].b - 1};
+    if (!exact || TrianglesOverlap(meshA, p.a, meshB, p.b))
+      pairs[kept++] = p;
+  }
+  return kept;
+}
+
+MeshIndex JoinMeshes(struct Node *rootA, const struct Mesh *meshA,
+                     struct Node *rootB, const struct Mesh *meshB, int exact,
+                     struct RTreePair *pairs, MeshIndex capacity,
+                     MeshIndex *needed) {
+  RTreeId candidates;
+  MeshIndex n = RTreeJoin(rootA, rootB, pairs, capacity, &candidates);
+  MeshIndex kept = FilterPairs(meshA, meshB, exact, pairs, n);
+
+  if (needed)
+    *needed = candidates > capacity ? candidates : kept;
+  return kept;
+}
+
+// Join of one pair of subtrees, into its own buffer
+typedef struct {
+  struct Node *a, *b;
+  struct RTreePair *pairs;
+  MeshIndex count;
+} JoinTask;
+
+typedef struct {
+  const struct Mesh *meshA, *meshB;
+  int exact;
+  JoinTask *tasks;
+} ParallelJoin;
+
+static void JoinChunkTask(void *arg, unsigned int chunk, int thread) {
+  ParallelJoin *pj = (ParallelJoin *)arg;
+  JoinTask *task = &pj->tasks[chunk];
+  RTreeId capacity = 0;
+  (void)thread;
+
+  // One walk of the subtree pair, into a buffer grown as it fills up
+  task->pairs = NULL;
+  MeshIndex n = RTreeJoinGrow(task->a, task->b, &task->pairs, &capacity);
+  if (n < 0) { // Out of memory
+    task->count = -1;
+    return;
+  }
+  task->count = FilterPairs(pj->meshA, pj->meshB, pj->exact, task->pairs, n);
+}
+
+MeshIndex JoinMeshesParallel(ThreadPool *pool, struct Node *rootA,
+                             const struct Mesh *meshA, struct Node *rootB,
+                             const struct Mesh *meshB, int exact,
+                             struct RTreePair *pairs, MeshIndex capacity,
+                             MeshIndex *needed) {
+  JoinTask tasks[MAXCARD * MAXCARD];
+  int ntasks = 0;
+
+  // Subtree pairs in the order RTreeJoin visits them: the children of the
+  // higher root with the other root, or the overlapping pairs of children
+  if (rootA->level > rootB->level) {
+    for (int i = 0; i < rootA->count; i++)
+      tasks[ntasks++] = (JoinTask){rootA->branch[i].child, rootB, NULL, 0};
+  } else if (rootB->level > rootA->level) {
+    for (int j = 0; j < rootB->count; j++)
+      tasks[ntasks++] = (JoinTask){rootA, rootB->branch[j].child, NULL, 0};
+  } else if (rootA->level > 0) {
+    for (int i = 0; i < rootA->count; i++)
+      for (int j = 0; j < rootB->count; j++)
+        if (RTreeOverlap(&rootA->branch[i].rect, &rootB->branch[j].rect))
+          tasks[ntasks++] = (JoinTask){rootA->branch[i].child,
+                                       rootB->branch[j].child, NULL, 0};
+  } else {
+    return JoinMeshes(rootA, meshA, rootB, meshB, exact, pairs, capacity,
+                      needed);
+  }
+
+  ParallelJoin pj = {meshA, meshB, exact, tasks};
+  ThreadPoolRunChunks(pool, JoinChunkTask, &pj, ntasks);
+
+  MeshIndex total = 0, written = 0;
+  for (int t = 0; t < ntasks; t++) {
+    if (tasks[t].count < 0) { // Out of memory
+      for (int u = 0; u < ntasks; u++)
+        free(tasks[u].pairs);
+      return -1;
+    }
+  }
+  for (int t = 0; t < ntasks; t++) {
+    MeshIndex n = tasks[t].count;
+    if (n > capacity - written)
+      n = capacity - written;
+    if (n > 0)
+      memcpy(pairs + written, tasks[t].pairs, sizeof(struct RTreePair) * n);
+    written += n;
+    total += tasks[t].count;
+    free(tasks[t].pairs);
+  }
+  if (needed)
+    *needed = total;
+  return written;
+}
+
+// Same traversal as RTreeSearch with SearchCallback, counting the nodes.
+// Returns 0 once the callback stopped the search.
+static int SearchCountingVisits(struct Node *n, struct Rect *r,
+                                SearchContext *ctx, int *visited) {
+  (*visited)++;
+  for (int i = 0; i < n->count; i++) {
+    struct Branch *b = &n->branch[i];
+    if (!RTreeOverlap(r, &b->rect))
+      continue;
+    if (n->level > 0) {
+      if (!SearchCountingVisits(b->child, r, ctx, visited))
+        return 0;
+    } else if (!SearchCallback(b->id, ctx)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+MeshIndex FindTriangleVisits(struct Node *root, const struct Mesh *mesh,
+                             struct Vertex p, int *visited) {
+  struct Rect searchRect;
+  searchRect.boundary[0] = p.x;
+  searchRect.boundary[1] = p.y;
+  searchRect.boundary[2] = p.x;
+  searchRect.boundary[3] = p.y;
+
+  SearchContext ctx;
+  ctx.mesh = mesh;
+  ctx.p = p;
+  ctx.foundIndex = -1;
+
+  SearchCountingVisits(root, &searchRect, &ctx, visited);
+  return ctx.foundIndex;
+}
@@ -0,0 +1,241 @@
+#include "../include/ThreadPool.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Share of chunks of a thread in ThreadPoolRunChunks: [head, tail) packed in
+// one word, so that the owner (taking from the head) and the thieves (taking
+// from the tail) update it with a single compare-and-swap. One per cache
+// line, written by its owner and by thieves only.
+typedef struct {
+  uint64_t range;
+  unsigned int stolen; // Chunks taken from others (written by the owner)
+  char pad[64 - sizeof(uint64_t) - sizeof(unsigned int)];
+} ChunkQueue;
+
+struct ThreadPool {
+  int nthreads;
+  pthread_t *workers; // nthreads - 1 workers, thread 0 is the caller
+  pthread_mutex_t lock;
+  pthread_cond_t start; // Signaled when a new task is posted
+  pthread_cond_t done;  // Signaled when the last worker finishes
+  ThreadTask task;
+  void *arg;
+  unsigned long generation; // Incremented for every posted task
+  int pending;              // Workers still running the current task
+  int stop;
+  ChunkQueue *queues; // One per thread, for ThreadPoolRunChunks
+  ChunkTask chunkTask;
+  void *chunkArg;
+};
+
+typedef struct {
+  ThreadPool *pool;
+  int thread;
+} WorkerArg;
+
+static void *WorkerMain(void *p) {
+  WorkerArg *w = (WorkerArg *)p;
+  ThreadPool *pool = w->pool;
+  int thread = w->thread;
+  unsigned long seen = 0;
+  free(w);
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop && pool->generation == seen)
+      pthread_cond_wait(&pool->start, &pool->lock);
+    if (pool->stop) {
+      pthread_mutex_unlock(&pool->lock);
+      return NULL;
+    }
+    seen = pool->generation;
+    ThreadTask task = pool->task;
+    void *arg = pool->arg;
+    pthread_mutex_unlock(&pool->lock);
+
+    task(arg, thread, pool->nthreads);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0)
+      pthread_cond_signal(&pool->done);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+ThreadPool *ThreadPoolCreate(int nthreads) {
+  ThreadPool *pool = malloc(sizeof(ThreadPool));
+  if (!pool)
+    return NULL;
+  if (nthreads < 1)
+    nthreads = 1;
+  pool->nthreads = nthreads;
+  pool->workers = malloc(sizeof(pthread_t) * nthreads);
+  if (!pool->workers) {
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->task = NULL;
+  pool->arg = NULL;
+  pool->generation = 0;
+  pool->pending = 0;
+  pool->stop = 0;
+  if (posix_memalign((void **)&pool->queues, 64,
+                     sizeof(ChunkQueue) * nthreads) != 0)
+    pool->queues = NULL;
+  for (int t = 0; pool->queues && t < nthreads; t++) {
+    pool->queues[t].range = 0;
+    pool->queues[t].stolen = 0;
+  }
+  pool->chunkTask = NULL;
+  pool->chunkArg = NULL;
+
+  for (int t = 1; t < nthreads; t++) {
+    WorkerArg *w = malloc(sizeof(WorkerArg));
+    if (!w) { // Stop the workers started so far
+      pool->nthreads = t;
+      ThreadPoolDestroy(pool);
+      return NULL;
+    }
+    w->pool = pool;
+    w->thread = t;
+    if (pthread_create(&pool->workers[t], NULL, WorkerMain, w) != 0) {
+      // Out of threads: the pool runs on the ones started (no task has been
+      // posted yet, so the workers read the smaller count)
+      free(w);
+      pool->nthreads = t;
+      break;
+    }
+  }
+  return pool;
+}
+
+void ThreadPoolRun(ThreadPool *pool, ThreadTask task, void *arg) {
+  pthread_mutex_lock(&pool->lock);
+  pool->task = task;
+  pool->arg = arg;
+  pool->pending = pool->nthreads - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  task(arg, 0, pool->nthreads); // The caller is thread 0
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->pending > 0)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static uint64_t PackRange(uint32_t head, uint32_t tail) {
+  return (uint64_t)head << 32 | tail;
+}
+
+// Takes the first chunk of q. Returns 0 if q is empty.
+static int TakeFront(ChunkQueue *q, uint32_t *chunk) {
+  uint64_t r = __atomic_load_n(&q->range, __ATOMIC_ACQUIRE);
+  for (;;) {
+    uint32_t head = (uint32_t)(r >> 32), tail = (uint32_t)r;
+    if (head >= tail)
+      return 0;
+    if (__atomic_compare_exchange_n(&q->range, &r, PackRange(head + 1, tail),
+                                    0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      *chunk = head;
+      return 1;
+    }
+  }
+}
+
+// Takes the back half of q (rounded up): chunks *first to *first + count - 1.
+// Returns count, 0 if q is empty.
+static uint32_t StealBack(ChunkQueue *q, uint32_t *first) {
+  uint64_t r = __atomic_load_n(&q->range, __ATOMIC_ACQUIRE);
+  for (;;) {
+    uint32_t head = (uint32_t)(r >> 32), tail = (uint32_t)r;
+    if (head >= tail)
+      return 0;
+    uint32_t count = (tail - head + 1) / 2;
+    if (__atomic_compare_exchange_n(&q->range, &r,
+                                    PackRange(head, tail - count), 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      *first = tail - count;
+      return count;
+    }
+  }
+}
+
+static void RunChunksTask(void *arg, int thread, int nthreads) {
+  ThreadPool *pool = (ThreadPool *)arg;
+  ChunkQueue *own = &pool->queues[thread];
+  uint32_t chunk, first, count;
+
+  for (;;) {
+    while (TakeFront(own, &chunk))
+      pool->chunkTask(pool->chunkArg, chunk, thread);
+
+    // Own share done: steal from the next threads. Chunks stolen by a
+    // thread but not published yet are invisible here, that thread runs
+    // them itself, so stopping when all shares look empty loses nothing.
+    count = 0;
+    for (int v = 1; v < nthreads && count == 0; v++)
+      count = StealBack(&pool->queues[(thread + v) % nthreads], &first);
+    if (count == 0)
+      return;
+    own->stolen += count;
+    // Own share is empty, so no thief updates it concurrently
+    __atomic_store_n(&own->range, PackRange(first, first + count),
+                     __ATOMIC_RELEASE);
+  }
+}
+
+void ThreadPoolRunChunks(ThreadPool *pool, ChunkTask task, void *arg,
+                         unsigned int nchunks) {
+  int n = pool->nthreads;
+
+  if (!pool->queues) { // Out of memory at creation: run them in order
+    for (unsigned int c = 0; c < nchunks; c++)
+      task(arg, c, 0);
+    return;
+  }
+  for (int t = 0; t < n; t++) {
+    uint32_t head = (uint32_t)((uint64_t)nchunks * t / n);
+    uint32_t tail = (uint32_t)((uint64_t)nchunks * (t + 1) / n);
+    pool->queues[t].range = PackRange(head, tail);
+    pool->queues[t].stolen = 0;
+  }
+  pool->chunkTask = task;
+  pool->chunkArg = arg;
+  ThreadPoolRun(pool, RunChunksTask, pool); // Its lock publishes the shares
+}
+
+unsigned int ThreadPoolStolenChunks(const ThreadPool *pool, int thread) {
+  return pool->queues ? pool->queues[thread].stolen : 0;
+}
+
+int ThreadPoolSize(const ThreadPool *pool) { return pool->nthreads; }
+
+void ThreadPoolDestroy(ThreadPool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int t = 1; t < pool->nthreads; t++)
+    pthread_join(pool->workers[t], NULL);
+
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->start);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->workers);
+  free(pool->queues);
+  free(pool);
+}
+
+int GetNumCores(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
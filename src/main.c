@@ -1,9 +1,17 @@
+#include "../include/EdgeTable.h"
 #include "../include/GnuplotExporter.h"
+#include "../include/MeshWalk.h"
+#include "../include/PointStream.h"
 #include "../include/RTreeWrapper.h"
+#include "../include/ThreadPool.h"
 #include "../include/mesh_io.h"
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 double GetTime() {
   struct timespec ts;
@@ -11,14 +19,222 @@ double GetTime() {
   return ts.tv_sec + ts.tv_nsec * 1e-9;
 }
 
-int main(int argc, char **argv) {
-  if (argc < 2) {
-    printf("Usage: %s <mesh_file> [num_test_points]\n", argv[0]);
+// Number of threads used by the parallel builder, set with --threads=N
+static int numThreads = 0;
+
+static struct Node *BuildParallel(struct RTreeContext *ctx,
+                                  const struct Mesh *mesh) {
+  return BuildRTreeParallel(ctx, mesh, numThreads);
+}
+
+// Available index construction methods, selected with --build=<name>
+typedef struct {
+  const char *name;
+  struct Node *(*build)(struct RTreeContext *ctx, const struct Mesh *mesh);
+} BuildMethod;
+
+static const BuildMethod buildMethods[] = {
+    {"insert", BuildRTree},         // One-at-a-time insertion (default),
+                                    // with the policy chosen by --policy
+    {"str", BuildRTreeSTR},         // Sort-Tile-Recursive bulk loading
+    {"hilbert", BuildRTreeHilbert}, // Hilbert curve packing
+    {"parallel", BuildParallel},    // Hilbert packing on numThreads threads
+};
+static const int numBuildMethods =
+    sizeof(buildMethods) / sizeof(buildMethods[0]);
+
+// Concurrent build check: several indexes are built at the same time by
+// one-at-a-time insertion, each with its own context (and leaf size).
+typedef struct {
+  const struct Mesh *mesh;
+  int count;
+  struct RTreeContext *contexts;
+  struct Node **roots;
+} ConcurrentBuild;
+
+// Order of RTreePair by triangle of the second mesh, then of the first
+static int ComparePairsByB(const void *x, const void *y) {
+  const struct RTreePair *p = (const struct RTreePair *)x;
+  const struct RTreePair *q = (const struct RTreePair *)y;
+  if (p->b != q->b)
+    return (p->b > q->b) - (p->b < q->b);
+  return (p->a > q->a) - (p->a < q->a);
+}
+
+// Growing array of hits, filled by a search callback (the way window
+// queries were collected before RTreeSearchWindow)
+typedef struct {
+  RTreeId *ids;
+  RTreeId count, capacity;
+} HitList;
+
+static int AppendHit(RTreeId id, void *arg) {
+  HitList *list = (HitList *)arg;
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? 2 * list->capacity : 64;
+    list->ids = realloc(list->ids, sizeof(RTreeId) * list->capacity);
+  }
+  list->ids[list->count++] = id;
+  return 1;
+}
+
+// Leaf size of tree k in the check, so that the trees really differ
+static int ConcurrentLeafMax(int k) { return 2 + k % (MAXCARD - 1); }
+
+static void ConcurrentBuildTask(void *arg, int thread, int nthreads) {
+  ConcurrentBuild *cb = (ConcurrentBuild *)arg;
+  for (int k = thread; k < cb->count; k += nthreads)
+    cb->roots[k] = BuildRTree(&cb->contexts[k], cb->mesh);
+}
+
+// Streaming mode (--stream): builds the index and locates the points of the
+// input, writing only results to the output; messages go to stderr.
+static int StreamMain(const char *meshFile, const BuildMethod *method,
+                      const struct RTreePolicy *policy, int hugePages,
+                      const StreamOptions *options) {
+  struct Mesh mesh;
+  initialize_mesh(&mesh);
+  if (read_mesh_from_medit_file(&mesh, meshFile) != 0) {
+    fprintf(stderr, "Failed to load mesh: %s\n", meshFile);
     return 1;
   }
 
-  const char *meshFile = argv[1];
-  int numPoints = (argc > 2) ? atoi(argv[2]) : 1000;
+  struct RTreeContext ctx;
+  RTreeInitContext(&ctx);
+  RTreeSetPolicy(&ctx, policy);
+  RTreeSetHugePages(&ctx, hugePages);
+  double start = GetTime();
+  struct Node *root = method->build(&ctx, &mesh);
+  fprintf(stderr,
+          "Mesh %s: " MESH_INDEX_FMT " triangles, R-Tree (%s) built in "
+          "%.6f seconds.\n",
+          meshFile, mesh.ntri, method->name, GetTime() - start);
+
+  // Without a pool (one thread, or out of memory) the stream runs serially
+  ThreadPool *pool = numThreads > 1 ? ThreadPoolCreate(numThreads) : NULL;
+  StreamStats stats;
+  int status = RunPointStream(pool, root, &mesh, options, &stats);
+  if (pool)
+    ThreadPoolDestroy(pool);
+  if (status != 0)
+    fprintf(stderr, "Streaming failed: input or output error (%s -> %s)\n",
+            options->input ? options->input : "-",
+            options->output ? options->output : "-");
+  fprintf(stderr,
+          "Streamed %lld points (%lld outside the mesh, %lld rejected) in "
+          "%.6f seconds: %.0f points/s\n",
+          stats.points, stats.outside, stats.rejected, stats.seconds,
+          stats.seconds > 0 ? stats.points / stats.seconds : 0.0);
+  fprintf(stderr, "Busy time per stage: read %.6f s, locate %.6f s (%d "
+                  "threads), write %.6f s\n",
+          stats.readSeconds, stats.locateSeconds, numThreads,
+          stats.writeSeconds);
+
+  dispose_mesh(&mesh);
+  RTreeFreeIndex(&ctx);
+  return status != 0;
+}
+
+int main(int argc, char **argv) {
+  const char *meshFile = NULL;
+  int numPoints = 1000;
+  const BuildMethod *method = &buildMethods[0];
+  int buildScaling = 0;
+  int concurrentTrees = 0;
+  const struct RTreePolicy *policy = &RTreeQuadraticPolicy;
+  int comparePolicies = 0;
+  int hugePages = 0;
+  enum RTreeFreezeLayout layout = RTREE_FREEZE_BFS;
+  int streaming = 0;
+  StreamOptions streamOptions = {NULL, NULL, STREAM_TEXT, STREAM_TEXT, 0};
+  int pointsGiven = 0, badArgs = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--build=", 8) == 0) {
+      method = NULL;
+      for (int m = 0; m < numBuildMethods; m++)
+        if (strcmp(argv[i] + 8, buildMethods[m].name) == 0)
+          method = &buildMethods[m];
+      if (!method) {
+        printf("Unknown build method: %s\n", argv[i] + 8);
+        return 1;
+      }
+    } else if (strncmp(argv[i], "--policy=", 9) == 0) {
+      policy = RTreeFindPolicy(argv[i] + 9);
+      if (!policy) {
+        printf("Unknown insertion policy: %s (available:", argv[i] + 9);
+        for (int p = 0; RTreePolicies[p]; p++)
+          printf(" %s", RTreePolicies[p]->name);
+        printf(")\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--layout=bfs") == 0) {
+      layout = RTREE_FREEZE_BFS;
+    } else if (strcmp(argv[i], "--layout=veb") == 0) {
+      layout = RTREE_FREEZE_VEB;
+    } else if (strcmp(argv[i], "--huge-pages") == 0) {
+      hugePages = 1;
+    } else if (strcmp(argv[i], "--compare-policies") == 0) {
+      comparePolicies = 1;
+    } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+      numThreads = atoi(argv[i] + 10);
+    } else if (strcmp(argv[i], "--build-scaling") == 0) {
+      buildScaling = 1;
+    } else if (strncmp(argv[i], "--concurrent-check=", 19) == 0) {
+      concurrentTrees = atoi(argv[i] + 19);
+    } else if (strcmp(argv[i], "--stream") == 0) {
+      streaming = 1;
+    } else if (strncmp(argv[i], "--stream=", 9) == 0) {
+      streaming = 1;
+      streamOptions.input = argv[i] + 9;
+    } else if (strcmp(argv[i], "--input-format=csv") == 0) {
+      streamOptions.inputFormat = STREAM_TEXT;
+    } else if (strcmp(argv[i], "--input-format=bin") == 0) {
+      streamOptions.inputFormat = STREAM_BINARY;
+    } else if (strncmp(argv[i], "--output=", 9) == 0) {
+      streamOptions.output = argv[i] + 9;
+    } else if (strcmp(argv[i], "--output-format=text") == 0) {
+      streamOptions.outputFormat = STREAM_TEXT;
+    } else if (strcmp(argv[i], "--output-format=bin") == 0) {
+      streamOptions.outputFormat = STREAM_BINARY;
+    } else if (strcmp(argv[i], "--weights") == 0) {
+      streamOptions.weights = 1;
+    } else if (strncmp(argv[i], "--", 2) == 0) {
+      printf("Unknown option: %s\n", argv[i]);
+      badArgs = 1;
+    } else if (!meshFile) {
+      meshFile = argv[i];
+    } else if (!pointsGiven) {
+      char *end;
+      long n = strtol(argv[i], &end, 10);
+      pointsGiven = 1;
+      numPoints = (int)n;
+      if (end == argv[i] || *end != '\0' || n < 1 || n > INT_MAX) {
+        printf("Invalid number of test points: %s\n", argv[i]);
+        badArgs = 1;
+      }
+    } else {
+      printf("Unexpected argument: %s\n", argv[i]);
+      badArgs = 1;
+    }
+  }
+
+  if (!meshFile || badArgs) {
+    printf("Usage: %s <mesh_file> [num_test_points] "
+           "[--build=insert|str|hilbert|parallel] [--policy=NAME] "
+           "[--compare-policies] [--layout=bfs|veb] [--huge-pages] "
+           "[--threads=N] "
+           "[--build-scaling] [--concurrent-check=K]\n"
+           "       %s <mesh_file> --stream[=FILE] [--input-format=csv|bin] "
+           "[--output=FILE] [--output-format=text|bin] [--weights] "
+           "[--build=...] [--policy=NAME]\n",
+           argv[0], argv[0]);
+    return 1;
+  }
+  if (numThreads < 1)
+    numThreads = GetNumCores();
+  if (streaming)
+    return StreamMain(meshFile, method, policy, hugePages, &streamOptions);
 
   printf("Loading mesh %s...\n", meshFile);
   struct Mesh mesh;
@@ -27,11 +243,13 @@ int main(int argc, char **argv) {
     printf("Failed to load mesh: %s\n", meshFile);
     return 1;
   }
-  printf("Mesh loaded: %d vertices, %d triangles.\n", mesh.nvert, mesh.ntri);
+  printf("Mesh loaded: " MESH_INDEX_FMT " vertices, " MESH_INDEX_FMT
+         " triangles.\n",
+         mesh.nvert, mesh.ntri);
 
   // Find mesh bbox for visualization and random points
   double minX = 1e9, minY = 1e9, maxX = -1e9, maxY = -1e9;
-  for (int i = 0; i < mesh.nvert; i++) {
+  for (MeshIndex i = 0; i < mesh.nvert; i++) {
     if (mesh.vertices[i].x < minX)
       minX = mesh.vertices[i].x;
     if (mesh.vertices[i].x > maxX)
@@ -43,11 +261,44 @@ int main(int argc, char **argv) {
   }
   printf("Mesh BBox: [%.2f, %.2f] x [%.2f, %.2f]\n", minX, maxX, minY, maxY);
 
-  printf("Building R-Tree...\n");
+  struct RTreeContext ctx;
+  RTreeInitContext(&ctx);
+  RTreeSetPolicy(&ctx, policy);
+  RTreeSetHugePages(&ctx, hugePages);
+
+  if (buildScaling) {
+    // Parallel build time from 1 thread up to numThreads (doubling)
+    printf("Parallel build scaling (" MESH_INDEX_FMT " triangles):\n",
+           mesh.ntri);
+    double timeOne = 0.0;
+    for (int t = 1;; t = (2 * t < numThreads) ? 2 * t : numThreads) {
+      double t0 = GetTime();
+      BuildRTreeParallel(&ctx, &mesh, t);
+      double elapsed = GetTime() - t0;
+      if (t == 1)
+        timeOne = elapsed;
+      printf("  %3d thread(s): %.6f seconds (speedup %.2fx)\n", t, elapsed,
+             timeOne / elapsed);
+      RTreeFreeIndex(&ctx);
+      if (t == numThreads)
+        break;
+    }
+  }
+
+  printf("Building R-Tree (%s, %s policy)...\n", method->name, policy->name);
   double start = GetTime();
-  struct Node *root = BuildRTree(&mesh);
+  struct Node *root = method->build(&ctx, &mesh);
   double end = GetTime();
   printf("R-Tree built in %.6f seconds.\n", end - start);
+  printf("Node arena: %d slab(s)%s.\n", ctx.arena.slabCount,
+         hugePages ? ", huge pages requested" : "");
+
+  TreeStats stats;
+  ComputeTreeStats(&ctx, root, &stats);
+  printf("R-Tree quality: height %d, %d nodes (%d leaves), leaf fill %.1f%%, "
+         "leaf area %.6g, sibling overlap %.6g\n",
+         stats.height, stats.nodes, stats.leaves, 100.0 * stats.leafFill,
+         stats.leafArea, stats.overlap);
 
   printf("Exporting to Gnuplot to 'plots/' directory...\n");
   ExportMeshToGnuplot(&mesh, "plots/mesh_edges.dat");
@@ -79,7 +330,7 @@ int main(int argc, char **argv) {
   ExportPointToGnuplot(query_point, "plots/query_point.dat");
 
   // Find the triangle containing the query point
-  int foundTriIndex = FindTriangle(root, &mesh, query_point);
+  MeshIndex foundTriIndex = FindTriangle(root, &mesh, query_point, NULL);
   if (foundTriIndex != -1) {
     ExportTriangleToGnuplot(mesh.triangles[foundTriIndex], &mesh,
                             "plots/found_triangle.dat");
@@ -112,7 +363,7 @@ int main(int argc, char **argv) {
   int hitsRTree = 0;
   start = GetTime();
   for (int i = 0; i < numPoints; i++) {
-    if (FindTriangle(root, &mesh, test_points[i]) != -1) {
+    if (FindTriangle(root, &mesh, test_points[i], NULL) != -1) {
       hitsRTree++;
     }
   }
@@ -120,12 +371,448 @@ int main(int argc, char **argv) {
   double timeRTree = end - start;
   printf("R-Tree: %.6f seconds (%d hits)\n", timeRTree, hitsRTree);
 
+  // Same queries through the iterative point-location fast path
+  printf("Benchmarking Point Location (RTreeLocatePoint)...\n");
+  int hitsLocate = 0;
+  start = GetTime();
+  for (int i = 0; i < numPoints; i++) {
+    if (RTreeLocatePoint(root, &mesh, test_points[i].x, test_points[i].y) !=
+        -1) {
+      hitsLocate++;
+    }
+  }
+  end = GetTime();
+  double timeLocate = end - start;
+  printf("Locate: %.6f seconds (%d hits, %.2fx vs R-Tree)\n", timeLocate,
+         hitsLocate, timeRTree / timeLocate);
+  printf("Per-query latency: FindTriangle %.1f ns, RTreeLocatePoint %.1f ns\n",
+         1e9 * timeRTree / numPoints, 1e9 * timeLocate / numPoints);
+  int diffLocate = 0;
+  for (int i = 0; i < numPoints; i++) {
+    if (RTreeLocatePoint(root, &mesh, test_points[i].x, test_points[i].y) !=
+        FindTriangle(root, &mesh, test_points[i], NULL)) {
+      diffLocate++;
+    }
+  }
+  if (diffLocate > 0)
+    printf("WARNING: RTreeLocatePoint and FindTriangle disagree on %d "
+           "points\n",
+           diffLocate);
+
+  // The same points as one batch, as given and in Morton order
+  MeshIndex *batchIds = malloc(sizeof(MeshIndex) * numPoints);
+  double timeBatch[2];
+  for (int sorted = 0; sorted < 2; sorted++) {
+    BatchOrder order = sorted ? BATCH_ORDER_MORTON : BATCH_ORDER_INPUT;
+    start = GetTime();
+    FindTrianglesBatch(root, &mesh, test_points, numPoints, batchIds, order);
+    end = GetTime();
+    timeBatch[sorted] = end - start;
+    int hitsBatch = 0, diffBatch = 0;
+    for (int i = 0; i < numPoints; i++) {
+      if (batchIds[i] != -1)
+        hitsBatch++;
+      if (batchIds[i] != FindTriangle(root, &mesh, test_points[i], NULL))
+        diffBatch++;
+    }
+    printf("Batch (%s order): %.6f seconds (%d hits, %.2fx vs R-Tree)\n",
+           sorted ? "Morton" : "input", timeBatch[sorted], hitsBatch,
+           timeRTree / timeBatch[sorted]);
+    if (diffBatch > 0)
+      printf("WARNING: batch results differ from FindTriangle on %d points\n",
+             diffBatch);
+  }
+  printf("Morton ordering: %.2fx vs unsorted batch\n",
+         timeBatch[0] / timeBatch[1]);
+
+  // Parallel batches, from 1 thread up to numThreads (doubling)
+  printf("Parallel batch location (%d queries, Morton order):\n", numPoints);
+  printf("  %7s %12s %14s %8s %8s\n", "threads", "time (s)", "queries/s",
+         "speedup", "stolen");
+  MeshIndex *parallelIds = malloc(sizeof(MeshIndex) * numPoints);
+  double timeParallelOne = 0.0;
+  for (int t = 1;; t = (2 * t < numThreads) ? 2 * t : numThreads) {
+    ThreadPool *pool = ThreadPoolCreate(t);
+    if (!pool) {
+      printf("Failed to create the thread pool (out of memory)\n");
+      return 1;
+    }
+    BatchThreadStats *threadStats;
+    if (posix_memalign((void **)&threadStats, 64,
+                       sizeof(BatchThreadStats) * t) != 0)
+      threadStats = NULL;
+    start = GetTime();
+    FindTrianglesParallel(pool, root, &mesh, test_points, numPoints,
+                          parallelIds, BATCH_ORDER_MORTON, threadStats);
+    end = GetTime();
+    double elapsed = end - start;
+    if (t == 1)
+      timeParallelOne = elapsed;
+    long long stolen = 0;
+    for (int k = 0; threadStats && k < ThreadPoolSize(pool); k++)
+      stolen += threadStats[k].stolen;
+    printf("  %7d %12.6f %14.0f %7.2fx %8lld\n", t, elapsed,
+           numPoints / elapsed, timeParallelOne / elapsed, stolen);
+    if (memcmp(parallelIds, batchIds, sizeof(MeshIndex) * numPoints) != 0)
+      printf("WARNING: parallel batch results differ from the batch ones\n");
+    free(threadStats);
+    ThreadPoolDestroy(pool);
+    if (t == numThreads)
+      break;
+  }
+  free(parallelIds);
+
+  // Same batch, interpolating a linear scalar field and a rotation vector
+  // field given at the vertices: both are reproduced exactly by barycentric
+  // interpolation, which makes the results easy to check
+  double *scalarField = malloc(sizeof(double) * mesh.nvert);
+  double *vectorField = malloc(sizeof(double) * 2 * mesh.nvert);
+  for (MeshIndex i = 0; i < mesh.nvert; i++) {
+    scalarField[i] = mesh.vertices[i].x + 2 * mesh.vertices[i].y + 3;
+    vectorField[2 * i] = mesh.vertices[i].y;
+    vectorField[2 * i + 1] = -mesh.vertices[i].x;
+  }
+  VertexField fields[2] = {{scalarField, 1}, {vectorField, 2}};
+  PointLocation *locations = malloc(sizeof(PointLocation) * numPoints);
+  double *interpolated = malloc(sizeof(double) * 3 * numPoints);
+  start = GetTime();
+  LocateAndInterpolate(root, &mesh, test_points, numPoints, fields, 2,
+                       locations, interpolated, BATCH_ORDER_MORTON);
+  end = GetTime();
+  printf("Locate and interpolate (1 scalar + 1 vector field, Morton order): "
+         "%.6f seconds (%.2fx the time of the batch alone)\n",
+         end - start, (end - start) / timeBatch[1]);
+  double tolerance = 1e-9 * ((maxX - minX) + (maxY - minY) + 3);
+  int diffInterp = 0;
+  for (int i = 0; i < numPoints; i++) {
+    const struct Vertex *p = &test_points[i];
+    const double *value = &interpolated[3 * i];
+    if (locations[i].triangle != batchIds[i])
+      diffInterp++;
+    else if (batchIds[i] >= 0 &&
+             (fabs(value[0] - (p->x + 2 * p->y + 3)) > tolerance ||
+              fabs(value[1] - p->y) > tolerance ||
+              fabs(value[2] + p->x) > tolerance ||
+              fabs(locations[i].weights[0] + locations[i].weights[1] +
+                   locations[i].weights[2] - 1) > 1e-9))
+      diffInterp++;
+  }
+  if (diffInterp > 0)
+    printf("WARNING: interpolated values wrong on %d points\n", diffInterp);
+  ThreadPool *interpPool = ThreadPoolCreate(numThreads);
+  if (!interpPool) {
+    printf("Failed to create the thread pool (out of memory)\n");
+    return 1;
+  }
+  PointLocation *parallelLocations = malloc(sizeof(PointLocation) * numPoints);
+  LocateAndInterpolateParallel(interpPool, root, &mesh, test_points,
+                               numPoints, NULL, 0, parallelLocations, NULL);
+  int diffParallel = 0;
+  for (int i = 0; i < numPoints; i++)
+    diffParallel += parallelLocations[i].triangle != locations[i].triangle ||
+                    memcmp(parallelLocations[i].weights, locations[i].weights,
+                           sizeof(locations[i].weights)) != 0;
+  if (diffParallel > 0)
+    printf("WARNING: parallel interpolation mismatch on %d points\n",
+           diffParallel);
+  free(parallelLocations);
+
+  // Streaming mode on the same points, written as text with a comment, a
+  // line that is not a point, CRLF line ends and no newline at the end
+  char streamIn[] = "/tmp/RTreeRUN_inXXXXXX";
+  char streamOut[] = "/tmp/RTreeRUN_outXXXXXX";
+  int inFd = mkstemp(streamIn), outFd = mkstemp(streamOut);
+  FILE *sf = inFd >= 0 ? fdopen(inFd, "w") : NULL;
+  if (sf && outFd >= 0) {
+    fprintf(sf, "# x y\n");
+    for (int i = 0; i < numPoints; i++) {
+      if (i == numPoints / 2)
+        fprintf(sf, "not a point\n");
+      fprintf(sf, "%.17g,%.17g%s", test_points[i].x, test_points[i].y,
+              i + 1 == numPoints ? "" : i % 2 ? "\r\n" : "\n");
+    }
+    fclose(sf);
+    sf = NULL;
+    close(outFd);
+    StreamOptions so = {streamIn, streamOut, STREAM_TEXT, STREAM_TEXT, 0};
+    StreamStats ss;
+    int status = RunPointStream(interpPool, root, &mesh, &so, &ss);
+    FILE *rf = fopen(streamOut, "r");
+    int diffStream = status != 0 || !rf || ss.rejected != 1 ||
+                     ss.points != numPoints + 1;
+    for (int i = 0, row = 0; rf && !diffStream && i < numPoints; row++) {
+      long long id;
+      if (fscanf(rf, "%lld", &id) != 1)
+        diffStream = 1;
+      else if (row == numPoints / 2)
+        diffStream = id != -1;
+      else
+        diffStream = id != (long long)batchIds[i++];
+    }
+    if (rf)
+      fclose(rf);
+    printf("Streaming mode: %lld points (%lld rejected) in %.6f seconds\n",
+           ss.points, ss.rejected, ss.seconds);
+    if (diffStream)
+      printf("WARNING: streaming results mismatch!\n");
+  }
+  if (sf)
+    fclose(sf);
+  if (inFd >= 0)
+    unlink(streamIn);
+  if (outFd >= 0)
+    unlink(streamOut);
+  ThreadPoolDestroy(interpPool);
+  free(scalarField);
+  free(vectorField);
+  free(locations);
+  free(interpolated);
+  free(batchIds);
+
+  // Coherent query stream (particle tracking): a random walk with steps of
+  // 0.5% of the mesh extent, every query hinted with the previous answer
+  MeshAdjacency adjacency;
+  start = GetTime();
+  if (!BuildMeshAdjacency(&mesh, &adjacency)) {
+    printf("Failed to build the mesh adjacency (out of memory)\n");
+    return 1;
+  }
+  end = GetTime();
+  printf("Mesh adjacency built in %.6f seconds.\n", end - start);
+  if (numPoints > 0) { // The walk starts from the first test point
+    struct Vertex *track = malloc(sizeof(struct Vertex) * numPoints);
+    struct Vertex particle = test_points[0];
+    for (int i = 0; i < numPoints; i++) {
+      particle.x += 0.005 * (maxX - minX) * (2.0 * rand() / RAND_MAX - 1.0);
+      particle.y += 0.005 * (maxY - minY) * (2.0 * rand() / RAND_MAX - 1.0);
+      particle.x = particle.x < minX ? minX : particle.x;
+      particle.x = particle.x > maxX ? maxX : particle.x;
+      particle.y = particle.y < minY ? minY : particle.y;
+      particle.y = particle.y > maxY ? maxY : particle.y;
+      track[i] = particle;
+    }
+    printf("Benchmarking Jump-and-Walk on a coherent stream...\n");
+    int hitsTrack = 0;
+    start = GetTime();
+    for (int i = 0; i < numPoints; i++) {
+      if (RTreeLocatePoint(root, &mesh, track[i].x, track[i].y) != -1)
+        hitsTrack++;
+    }
+    end = GetTime();
+    double timeTrack = end - start;
+    WalkStats walkStats = {0, 0, 0};
+    int hitsWalk = 0;
+    MeshIndex previous = -1;
+    start = GetTime();
+    for (int i = 0; i < numPoints; i++) {
+      previous = WalkLocatePoint(&adjacency, root, &mesh, track[i].x,
+                                 track[i].y, previous, &walkStats);
+      if (previous != -1)
+        hitsWalk++;
+    }
+    end = GetTime();
+    double timeWalk = end - start;
+    printf("Locate (stream): %.6f seconds (%d hits)\n", timeTrack, hitsTrack);
+    printf("Walk (stream):   %.6f seconds (%d hits, %.2fx vs Locate), "
+           "%.2f steps/query, %lld fallback(s)\n",
+           timeWalk, hitsWalk, timeTrack / timeWalk,
+           (double)walkStats.steps / walkStats.queries, walkStats.fallbacks);
+    if (hitsWalk != hitsTrack)
+      printf("WARNING: Hit counts mismatch! Walk: %d, Locate: %d\n", hitsWalk,
+             hitsTrack);
+    int walkDisagree = 0;
+    previous = -1;
+    for (int i = 0; i < numPoints; i++) {
+      previous = WalkLocatePoint(&adjacency, root, &mesh, track[i].x,
+                                 track[i].y, previous, NULL);
+      int located = RTreeLocatePoint(root, &mesh, track[i].x, track[i].y) != -1;
+      if ((previous != -1) != located)
+        walkDisagree++;
+    }
+    if (walkDisagree)
+      printf("WARNING: Walk and Locate mismatch on %d point(s)\n",
+             walkDisagree);
+
+    // Same stream through FindTriangle, without and with a cursor
+    int hitsFind = 0, hitsFinger = 0;
+    start = GetTime();
+    for (int i = 0; i < numPoints; i++) {
+      if (FindTriangle(root, &mesh, track[i], NULL) != -1)
+        hitsFind++;
+    }
+    end = GetTime();
+    double timeFind = end - start;
+    LocateCursor cursor;
+    InitLocateCursor(&cursor);
+    start = GetTime();
+    for (int i = 0; i < numPoints; i++) {
+      if (FindTriangle(root, &mesh, track[i], &cursor) != -1)
+        hitsFinger++;
+    }
+    end = GetTime();
+    double timeFinger = end - start;
+    printf("FindTriangle (stream):        %.6f seconds (%d hits)\n", timeFind,
+           hitsFind);
+    printf("FindTriangle + cursor:        %.6f seconds (%d hits, %.2fx), "
+           "answered by the same triangle %lld, same leaf %lld, "
+           "climbing %lld\n",
+           timeFinger, hitsFinger, timeFind / timeFinger, cursor.sameTriangle,
+           cursor.sameLeaf, cursor.climbed);
+    if (hitsFinger != hitsFind)
+      printf("WARNING: Hit counts mismatch! Cursor: %d, FindTriangle: %d\n",
+             hitsFinger, hitsFind);
+
+    // Point by point, Locate and FindTriangle must agree on edge points too
+    int disagree = 0;
+    for (int i = 0; i < numPoints; i++) {
+      int located = RTreeLocatePoint(root, &mesh, track[i].x, track[i].y) != -1;
+      int found = FindTriangle(root, &mesh, track[i], NULL) != -1;
+      if (located != found)
+        disagree++;
+    }
+    if (disagree)
+      printf("WARNING: Locate and FindTriangle mismatch on %d point(s)\n",
+             disagree);
+    free(track);
+  }
+  FreeMeshAdjacency(&adjacency);
+
+  // Same queries on the frozen copy of the tree
+  struct FrozenIndex frozen;
+  start = GetTime();
+  if (!RTreeFreeze(root, layout, &frozen)) {
+    printf("Failed to freeze the R-Tree (out of memory)\n");
+    return 1;
+  }
+  end = GetTime();
+  printf("Frozen R-Tree (%s layout, %d nodes, %zu bytes) in %.6f seconds.\n",
+         layout == RTREE_FREEZE_VEB ? "veb" : "bfs", frozen.nodeCount,
+         frozen.nodeCount * sizeof(struct FrozenNode), end - start);
+
+  printf("Benchmarking Frozen R-Tree Search...\n");
+  int hitsFrozen = 0;
+  start = GetTime();
+  for (int i = 0; i < numPoints; i++) {
+    if (FindTriangleFrozen(&frozen, &mesh, test_points[i]) != -1) {
+      hitsFrozen++;
+    }
+  }
+  end = GetTime();
+  double timeFrozen = end - start;
+  printf("Frozen: %.6f seconds (%d hits, %.2fx vs R-Tree)\n", timeFrozen,
+         hitsFrozen, timeRTree / timeFrozen);
+  if (hitsFrozen != hitsRTree)
+    printf("WARNING: Hit counts mismatch! Frozen: %d, RTree: %d\n",
+           hitsFrozen, hitsRTree);
+  size_t frozenBytes = frozen.nodeCount * sizeof(struct FrozenNode);
+  RTreeFreeFrozen(&frozen);
+
+  // Same queries on frozen leaves that carry the triangle corners
+  GeomIndex geom;
+  if (!BuildGeomIndex(root, &mesh, layout, &geom)) {
+    printf("Failed to build the geometry leaves (out of memory)\n");
+    return 1;
+  }
+  printf("Benchmarking Geometry Leaves Search...\n");
+  int hitsGeom = 0;
+  start = GetTime();
+  for (int i = 0; i < numPoints; i++) {
+    if (FindTriangleGeom(&geom, test_points[i]) != -1) {
+      hitsGeom++;
+    }
+  }
+  end = GetTime();
+  double timeGeom = end - start;
+  printf("Geometry leaves: %.6f seconds (%d hits, %.2fx vs R-Tree)\n",
+         timeGeom, hitsGeom, timeRTree / timeGeom);
+  if (hitsGeom != hitsRTree)
+    printf("WARNING: Hit counts mismatch! Geometry: %d, RTree: %d\n",
+           hitsGeom, hitsRTree);
+  size_t geomBytes = geom.index.nodeCount * sizeof(struct FrozenNode) +
+                     geom.leafCount * sizeof(GeomLeaf);
+  FreeGeomIndex(&geom);
+
+  // Same queries with leaves tested by precomputed edge functions
+  EdgeIndex edges;
+  if (!BuildEdgeIndex(root, &mesh, layout, &edges)) {
+    printf("Failed to build the edge-function leaves (out of memory)\n");
+    return 1;
+  }
+  printf("Benchmarking Edge-Function Leaves Search...\n");
+  int hitsEdge = 0;
+  start = GetTime();
+  for (int i = 0; i < numPoints; i++) {
+    if (FindTriangleEdge(&edges, test_points[i]) != -1) {
+      hitsEdge++;
+    }
+  }
+  end = GetTime();
+  double timeEdge = end - start;
+  printf("Edge-function leaves: %.6f seconds (%d hits, %.2fx vs R-Tree, "
+         "%.2fx vs Frozen)\n",
+         timeEdge, hitsEdge, timeRTree / timeEdge, timeFrozen / timeEdge);
+  if (hitsEdge != hitsRTree)
+    printf("WARNING: Hit counts mismatch! Edge functions: %d, RTree: %d\n",
+           hitsEdge, hitsRTree);
+  size_t edgeBytes = edges.index.nodeCount * sizeof(struct FrozenNode) +
+                     edges.table.rows * (9 * sizeof(double) + sizeof(MeshIndex));
+  FreeEdgeIndex(&edges);
+
+  // Same queries on the quantized copy (wide internal nodes)
+  struct QuantIndex quant;
+  if (!RTreeQuantize(root, &quant)) {
+    printf("Failed to quantize the R-Tree (out of memory or too high)\n");
+    return 1;
+  }
+  printf("Quantized R-Tree (%d-bit child rects, up to %d children): "
+         "height %d, %d nodes + %d leaves.\n",
+         RTREE_QUANT_BITS, QUANTCARD, quant.height, quant.nodeCount,
+         quant.leafCount);
+  printf("Benchmarking Quantized R-Tree Search...\n");
+  int hitsQuant = 0;
+  start = GetTime();
+  for (int i = 0; i < numPoints; i++) {
+    if (FindTriangleQuant(&quant, &mesh, test_points[i], NULL) != -1) {
+      hitsQuant++;
+    }
+  }
+  end = GetTime();
+  double timeQuant = end - start;
+  printf("Quantized: %.6f seconds (%d hits, %.2fx vs R-Tree)\n", timeQuant,
+         hitsQuant, timeRTree / timeQuant);
+  if (hitsQuant != hitsRTree)
+    printf("WARNING: Hit counts mismatch! Quantized: %d, RTree: %d\n",
+           hitsQuant, hitsRTree);
+
+  // Memory per triangle and nodes touched per query of each layout
+  int visitedRTree = 0, visitedQuant = 0;
+  for (int i = 0; i < numPoints; i++) {
+    FindTriangleVisits(root, &mesh, test_points[i], &visitedRTree);
+    FindTriangleQuant(&quant, &mesh, test_points[i], &visitedQuant);
+  }
+  size_t treeBytes = stats.nodes * sizeof(struct Node);
+  size_t quantBytes = quant.nodeCount * sizeof(struct QuantNode) +
+                      quant.leafCount * sizeof(struct FrozenNode);
+  double perQuery = numPoints ? 1.0 / numPoints : 0.0;
+  printf("  %-10s %16s %14s\n", "index", "bytes/triangle", "nodes/query");
+  printf("  %-10s %16.1f %14.2f\n", "R-Tree", (double)treeBytes / mesh.ntri,
+         visitedRTree * perQuery);
+  printf("  %-10s %16.1f %14.2f\n", "frozen", (double)frozenBytes / mesh.ntri,
+         visitedRTree * perQuery); // same nodes as the R-Tree
+  printf("  %-10s %16.1f %14.2f\n", "geometry", (double)geomBytes / mesh.ntri,
+         visitedRTree * perQuery); // same nodes, no mesh access
+  printf("  %-10s %16.1f %14.2f\n", "edges", (double)edgeBytes / mesh.ntri,
+         visitedRTree * perQuery); // same nodes, no mesh access
+  printf("  %-10s %16.1f %14.2f\n", "quantized",
+         (double)quantBytes / mesh.ntri, visitedQuant * perQuery);
+  RTreeFreeQuantized(&quant);
+
   printf("Benchmarking Naive Search...\n");
   int hitsNaive = 0;
   start = GetTime();
   for (int i = 0; i < numPoints; i++) {
     struct Vertex current_test_point = test_points[i];
-    for (int j = 0; j < mesh.ntri; j++) {
+    for (MeshIndex j = 0; j < mesh.ntri; j++) {
       struct Triangle t = mesh.triangles[j];
       struct Vertex p1 = mesh.vertices[t.v1];
       struct Vertex p2 = mesh.vertices[t.v2];
@@ -140,6 +827,29 @@ int main(int argc, char **argv) {
   double timeNaive = end - start;
   printf("Naive:  %.6f seconds (%d hits)\n", timeNaive, hitsNaive);
 
+  // Same brute force on the edge-function table of the whole mesh
+  EdgeTable table;
+  if (!BuildEdgeTable(&mesh, NULL, 0, &table)) {
+    printf("Failed to build the edge-function table (out of memory)\n");
+    return 1;
+  }
+  int hitsNaiveEdge = 0;
+  start = GetTime();
+  for (int i = 0; i < numPoints; i++) {
+    if (EdgeTableFind(&table, 0, table.rows, test_points[i].x,
+                      test_points[i].y) != -1) {
+      hitsNaiveEdge++;
+    }
+  }
+  end = GetTime();
+  double timeNaiveEdge = end - start;
+  printf("Naive (edge table): %.6f seconds (%d hits, %.2fx vs Naive)\n",
+         timeNaiveEdge, hitsNaiveEdge, timeNaive / timeNaiveEdge);
+  if (hitsNaiveEdge != hitsNaive)
+    printf("WARNING: Hit counts mismatch! Naive (edge table): %d, Naive: %d\n",
+           hitsNaiveEdge, hitsNaive);
+  FreeEdgeTable(&table);
+
   printf("Speedup: %.2fx\n", timeNaive / timeRTree);
   printf("Absolute Time Difference: %.6f seconds\n", timeNaive - timeRTree);
 
@@ -151,13 +861,463 @@ int main(int argc, char **argv) {
     printf("Correctness Check: PASS (Hit counts match)\n");
   }
 
+  // Nearest triangle of the points that fell outside the mesh, as when
+  // clamping them to its boundary
+  struct Vertex *outside = malloc(sizeof(struct Vertex) * numPoints);
+  int numOutside = 0;
+  for (int i = 0; i < numPoints; i++)
+    if (RTreeLocatePoint(root, &mesh, test_points[i].x, test_points[i].y) ==
+        -1)
+      outside[numOutside++] = test_points[i];
+  if (numOutside > 0) {
+    printf("Benchmarking Nearest Triangle Search (%d points outside)...\n",
+           numOutside);
+    MeshIndex *nearest = malloc(sizeof(MeshIndex) * numOutside);
+    double *nearestDist = malloc(sizeof(double) * numOutside);
+    start = GetTime();
+    for (int i = 0; i < numOutside; i++)
+      RTreeNearestTriangle(root, &mesh, outside[i].x, outside[i].y, 1,
+                           &nearest[i], &nearestDist[i]);
+    end = GetTime();
+    double timeNearest = end - start;
+
+    // Same distances by brute force (ties may pick another triangle)
+    int nearestMismatches = 0;
+    start = GetTime();
+    for (int i = 0; i < numOutside; i++) {
+      double best = -1;
+      for (MeshIndex j = 0; j < mesh.ntri; j++) {
+        double d = PointTriangleDistance(&mesh, j, outside[i].x, outside[i].y);
+        if (best < 0 || d < best)
+          best = d;
+      }
+      if (best != nearestDist[i])
+        nearestMismatches++;
+    }
+    end = GetTime();
+    double timeNearestNaive = end - start;
+    printf("Nearest (k = 1): %.6f seconds (%.0f ns/query, %.2fx vs brute "
+           "force)\n",
+           timeNearest, 1e9 * timeNearest / numOutside,
+           timeNearestNaive / timeNearest);
+
+    // k nearest come out sorted, the first one being the nearest
+    MeshIndex knn[8];
+    double knnDist[8];
+    start = GetTime();
+    for (int i = 0; i < numOutside; i++) {
+      int found = RTreeNearestTriangle(root, &mesh, outside[i].x,
+                                       outside[i].y, 8, knn, knnDist);
+      if (found < 1 || knnDist[0] != nearestDist[i])
+        nearestMismatches++;
+      for (int j = 1; j < found; j++)
+        if (knnDist[j] < knnDist[j - 1])
+          nearestMismatches++;
+    }
+    end = GetTime();
+    printf("Nearest (k = 8): %.6f seconds (%.0f ns/query)\n", end - start,
+           1e9 * (end - start) / numOutside);
+    if (nearestMismatches)
+      printf("WARNING: Nearest triangle mismatch on %d queries!\n",
+             nearestMismatches);
+    free(nearest);
+    free(nearestDist);
+  }
+  free(outside);
+
+  // Region extraction: the triangles overlapping each tile of a grid over
+  // the mesh, collected by callback, into a fixed buffer, or only counted
+  const int tiles = 16;
+  MeshIndex tileCapacity = 1024;
+  MeshIndex *tileIds = malloc(sizeof(MeshIndex) * tileCapacity);
+  HitList list = {NULL, 0, 0};
+  long long candidatesCallback = 0, candidatesWindow = 0, candidatesCount = 0;
+  long long exactHits = 0;
+  double timeCallback = 0, timeWindow = 0, timeCount = 0;
+  for (int ty = 0; ty < tiles; ty++) {
+    for (int tx = 0; tx < tiles; tx++) {
+      struct Rect tile;
+      tile.boundary[0] = minX + (maxX - minX) * tx / tiles;
+      tile.boundary[1] = minY + (maxY - minY) * ty / tiles;
+      tile.boundary[NUMDIMS] = minX + (maxX - minX) * (tx + 1) / tiles;
+      tile.boundary[1 + NUMDIMS] = minY + (maxY - minY) * (ty + 1) / tiles;
+
+      list.count = 0;
+      start = GetTime();
+      RTreeSearch(root, &tile, AppendHit, &list);
+      timeCallback += GetTime() - start;
+      candidatesCallback += list.count;
+
+      RTreeId needed;
+      start = GetTime();
+      RTreeId written = RTreeSearchWindow(root, &tile, (RTreeId *)tileIds,
+                                          tileCapacity, &needed);
+      if (needed > written) { // Buffer too small: grow it and run again
+        tileCapacity = needed;
+        tileIds = realloc(tileIds, sizeof(MeshIndex) * tileCapacity);
+        written = RTreeSearchWindow(root, &tile, (RTreeId *)tileIds,
+                                    tileCapacity, &needed);
+      }
+      timeWindow += GetTime() - start;
+      candidatesWindow += written;
+      if (written != list.count ||
+          (written > 0 &&
+           memcmp(tileIds, list.ids, sizeof(RTreeId) * written) != 0))
+        printf("WARNING: Window query mismatch on tile (%d, %d)!\n", tx, ty);
+
+      start = GetTime();
+      candidatesCount += RTreeCountWindow(root, &tile);
+      timeCount += GetTime() - start;
+
+      exactHits += FindTrianglesInWindow(root, &mesh, &tile, tileIds,
+                                         tileCapacity, NULL);
+    }
+  }
+  printf("Window queries (%dx%d tiles, %lld candidates, %lld triangles "
+         "overlapping):\n",
+         tiles, tiles, candidatesWindow, exactHits);
+  printf("  callback: %.6f s, buffer: %.6f s (%.2fx), count only: %.6f s "
+         "(%.2fx)\n",
+         timeCallback, timeWindow, timeCallback / timeWindow, timeCount,
+         timeCallback / timeCount);
+  if (candidatesCallback != candidatesWindow ||
+      candidatesCount != candidatesWindow)
+    printf("WARNING: Window hit counts mismatch! Callback: %lld, buffer: "
+           "%lld, count: %lld\n",
+           candidatesCallback, candidatesWindow, candidatesCount);
+  if (exactHits < mesh.ntri || exactHits > candidatesWindow)
+    printf("WARNING: %lld triangles overlapping the tiles, expected between "
+           "%lld and %lld\n",
+           exactHits, (long long)mesh.ntri, candidatesWindow);
+  free(list.ids);
+  free(tileIds);
+
+  // Triangles crossed by short segments (a twentieth of the mesh extent)
+  // starting at the test points, against sampling points along them
+  int numSegments = numPoints < 2000 ? numPoints : 2000;
+  const int samples = 64;
+  double segmentLength = 0.05 * ((maxX - minX) + (maxY - minY)) / 2;
+  MeshIndex segmentCapacity = 256;
+  SegmentHit *segmentHits = malloc(sizeof(SegmentHit) * segmentCapacity);
+  struct Vertex *segmentEnds = malloc(sizeof(struct Vertex) * numSegments);
+  long long crossed = 0, sampled = 0, segmentErrors = 0;
+  for (int i = 0; i < numSegments; i++) {
+    struct Vertex a = test_points[i];
+    struct Vertex toward = test_points[(i + 1) % numPoints];
+    double dx = toward.x - a.x, dy = toward.y - a.y;
+    double len = sqrt(dx * dx + dy * dy);
+    segmentEnds[i] = a;
+    if (len > 0) {
+      segmentEnds[i].x += segmentLength * dx / len;
+      segmentEnds[i].y += segmentLength * dy / len;
+    }
+  }
+  start = GetTime();
+  for (int i = 0; i < numSegments; i++) {
+    MeshIndex needed;
+    MeshIndex n = FindTrianglesOnSegment(
+        root, &mesh, test_points[i].x, test_points[i].y, segmentEnds[i].x,
+        segmentEnds[i].y, segmentHits, segmentCapacity, &needed);
+    if (needed > n) { // Buffer too small: grow it and run again
+      segmentCapacity = needed;
+      segmentHits = realloc(segmentHits, sizeof(SegmentHit) * needed);
+      n = FindTrianglesOnSegment(root, &mesh, test_points[i].x,
+                                 test_points[i].y, segmentEnds[i].x,
+                                 segmentEnds[i].y, segmentHits,
+                                 segmentCapacity, &needed);
+    }
+    crossed += n;
+  }
+  end = GetTime();
+  double timeSegments = end - start;
+
+  // Sampling: every triangle it finds must be among the crossed ones
+  double timeSampling = 0;
+  for (int i = 0; i < numSegments; i++) {
+    MeshIndex n = FindTrianglesOnSegment(
+        root, &mesh, test_points[i].x, test_points[i].y, segmentEnds[i].x,
+        segmentEnds[i].y, segmentHits, segmentCapacity, NULL);
+    for (MeshIndex j = 1; j < n; j++)
+      if (segmentHits[j].tEnter < segmentHits[j - 1].tEnter)
+        segmentErrors++;
+    MeshIndex last = -1;
+    start = GetTime();
+    for (int k = 0; k <= samples; k++) {
+      double t = (double)k / samples;
+      MeshIndex tri = RTreeLocatePoint(
+          root, &mesh, test_points[i].x + t * (segmentEnds[i].x - test_points[i].x),
+          test_points[i].y + t * (segmentEnds[i].y - test_points[i].y));
+      if (tri < 0 || tri == last)
+        continue;
+      last = tri;
+      sampled++;
+      MeshIndex j = 0;
+      while (j < n && segmentHits[j].triangle != tri)
+        j++;
+      if (j == n)
+        segmentErrors++;
+    }
+    timeSampling += GetTime() - start;
+  }
+
+  // Brute force on a few segments: the pruning must not lose any triangle
+  for (int i = 0; i < numSegments && i < 20; i++) {
+    MeshIndex needed, brute = 0;
+    FindTrianglesOnSegment(root, &mesh, test_points[i].x, test_points[i].y,
+                           segmentEnds[i].x, segmentEnds[i].y, segmentHits,
+                           segmentCapacity, &needed);
+    for (MeshIndex j = 0; j < mesh.ntri; j++) {
+      double t0, t1;
+      brute += ClipSegmentToTriangle(&mesh, j, test_points[i].x,
+                                     test_points[i].y, segmentEnds[i].x,
+                                     segmentEnds[i].y, &t0, &t1);
+    }
+    if (brute != needed)
+      segmentErrors++;
+  }
+  printf("Segment queries (%d segments, %lld triangles crossed): %.6f s; "
+         "sampling %d points each: %.6f s, finds %lld of them\n",
+         numSegments, crossed, timeSegments, samples + 1, timeSampling,
+         sampled);
+
+  // Polylines through groups of 100 test points (long segments across the
+  // mesh), against the same segments queried one by one
+  long long crossedPolyline = 0;
+  double timePolyline = 0;
+  for (int i = 0; i + 1 < numSegments; i += 100) {
+    MeshIndex count = numSegments - i < 100 ? numSegments - i : 100;
+    MeshIndex needed, total = 0;
+    start = GetTime();
+    MeshIndex n = FindTrianglesOnPolyline(root, &mesh, test_points + i, count,
+                                          segmentHits, segmentCapacity,
+                                          &needed);
+    if (needed > n) {
+      segmentCapacity = needed;
+      segmentHits = realloc(segmentHits, sizeof(SegmentHit) * needed);
+      n = FindTrianglesOnPolyline(root, &mesh, test_points + i, count,
+                                  segmentHits, segmentCapacity, &needed);
+    }
+    timePolyline += GetTime() - start;
+    crossedPolyline += n;
+    for (MeshIndex j = 1; j < n; j++)
+      if (segmentHits[j].segment < segmentHits[j - 1].segment)
+        segmentErrors++;
+    for (MeshIndex j = 0; j + 1 < count; j++) {
+      MeshIndex segmentNeeded;
+      FindTrianglesOnSegment(root, &mesh, test_points[i + j].x,
+                             test_points[i + j].y, test_points[i + j + 1].x,
+                             test_points[i + j + 1].y, segmentHits, 0,
+                             &segmentNeeded);
+      total += segmentNeeded;
+    }
+    if (total != n)
+      segmentErrors++;
+  }
+  printf("Polyline queries (%lld triangles crossed): %.6f s\n",
+         crossedPolyline, timePolyline);
+  if (segmentErrors)
+    printf("WARNING: Segment query mismatch on %lld checks!\n",
+           segmentErrors);
+  free(segmentHits);
+  free(segmentEnds);
+
+  // Spatial join with a shifted copy of the mesh, as when remapping a field
+  // between two meshes of the same domain
+  struct Mesh shifted = mesh;
+  shifted.vertices = malloc(sizeof(struct Vertex) * mesh.nvert);
+  for (MeshIndex i = 0; i < mesh.nvert; i++) {
+    shifted.vertices[i] = mesh.vertices[i];
+    shifted.vertices[i].x += 0.013 * (maxX - minX);
+    shifted.vertices[i].y += 0.017 * (maxY - minY);
+  }
+  struct RTreeContext shiftedCtx;
+  RTreeInitContext(&shiftedCtx);
+  struct Node *shiftedRoot = BuildRTreeSTR(&shiftedCtx, &shifted);
+
+  // One search in the first tree per triangle of the copy
+  long long candidatesSearch = 0;
+  start = GetTime();
+  for (MeshIndex i = 0; i < shifted.ntri; i++) {
+    struct Rect r;
+    RTreeInitRect(&r);
+    for (int k = 0; k < 3; k++) {
+      const struct Vertex *v = &shifted.vertices[shifted.triangles[i].idx[k]];
+      if (k == 0 || v->x < r.boundary[0])
+        r.boundary[0] = v->x;
+      if (k == 0 || v->y < r.boundary[1])
+        r.boundary[1] = v->y;
+      if (k == 0 || v->x > r.boundary[NUMDIMS])
+        r.boundary[NUMDIMS] = v->x;
+      if (k == 0 || v->y > r.boundary[1 + NUMDIMS])
+        r.boundary[1 + NUMDIMS] = v->y;
+    }
+    candidatesSearch += RTreeSearch(root, &r, NULL, NULL);
+  }
+  end = GetTime();
+  double timeJoinSearch = end - start;
+
+  // Buffer sized by a first, untimed pass (no buffer: counts only), so that
+  // the timed joins run once each
+  MeshIndex joinCapacity, joinNeeded;
+  JoinMeshes(root, &mesh, shiftedRoot, &shifted, 0, NULL, 0, &joinCapacity);
+  struct RTreePair *joinPairs =
+      malloc(sizeof(struct RTreePair) * (joinCapacity > 0 ? joinCapacity : 1));
+  double timeJoin[2];
+  MeshIndex joinCount[2];
+  for (int exact = 0; exact < 2; exact++) {
+    start = GetTime();
+    joinCount[exact] = JoinMeshes(root, &mesh, shiftedRoot, &shifted, exact,
+                                  joinPairs, joinCapacity, &joinNeeded);
+    timeJoin[exact] = GetTime() - start;
+  }
+  printf("Spatial join with a shifted copy (%lld candidate pairs, %lld "
+         "overlapping):\n",
+         (long long)joinCount[0], (long long)joinCount[1]);
+  printf("  search per triangle: %.6f s, join: %.6f s (%.2fx), exact: "
+         "%.6f s\n",
+         timeJoinSearch, timeJoin[0], timeJoinSearch / timeJoin[0],
+         timeJoin[1]);
+  if (candidatesSearch != joinCount[0])
+    printf("WARNING: Join candidate mismatch! Join: %lld, searches: %lld\n",
+           (long long)joinCount[0], candidatesSearch);
+
+  // Parallel join: same pairs in the same order
+  struct RTreePair *parallelPairs =
+      malloc(sizeof(struct RTreePair) * joinCapacity);
+  ThreadPool *joinPool = ThreadPoolCreate(numThreads);
+  if (!joinPool) {
+    printf("Failed to create the thread pool (out of memory)\n");
+    return 1;
+  }
+  start = GetTime();
+  MeshIndex parallelCount =
+      JoinMeshesParallel(joinPool, root, &mesh, shiftedRoot, &shifted, 1,
+                         parallelPairs, joinCapacity, &joinNeeded);
+  end = GetTime();
+  printf("  exact join on %d threads: %.6f s\n", ThreadPoolSize(joinPool),
+         end - start);
+  ThreadPoolDestroy(joinPool);
+  if (parallelCount < 0)
+    printf("WARNING: Parallel join out of memory!\n");
+  else if (parallelCount != joinCount[1] || joinNeeded != joinCount[1] ||
+      (parallelCount > 0 &&
+       memcmp(parallelPairs, joinPairs,
+              sizeof(struct RTreePair) * parallelCount) != 0))
+    printf("WARNING: Parallel join mismatch! %lld pairs, %lld expected\n",
+           (long long)parallelCount, (long long)joinCount[1]);
+
+  // The triangle containing the centroid of a triangle of the copy overlaps
+  // it: that pair must be among the exact ones
+  qsort(joinPairs, joinCount[1], sizeof(struct RTreePair), ComparePairsByB);
+  int joinMissing = 0;
+  for (MeshIndex i = 0; i < shifted.ntri; i++) {
+    const struct Triangle *t = &shifted.triangles[i];
+    double cx = (shifted.vertices[t->v1].x + shifted.vertices[t->v2].x +
+                 shifted.vertices[t->v3].x) / 3;
+    double cy = (shifted.vertices[t->v1].y + shifted.vertices[t->v2].y +
+                 shifted.vertices[t->v3].y) / 3;
+    struct RTreePair key = {RTreeLocatePoint(root, &mesh, cx, cy), i};
+    if (key.a >= 0 && !bsearch(&key, joinPairs, joinCount[1],
+                               sizeof(struct RTreePair), ComparePairsByB))
+      joinMissing++;
+  }
+  if (joinMissing)
+    printf("WARNING: %d overlapping pairs missing from the exact join!\n",
+           joinMissing);
+  free(parallelPairs);
+  free(joinPairs);
+  RTreeFreeIndex(&shiftedCtx);
+  free(shifted.vertices);
+
+  if (comparePolicies) {
+    // Same mesh, one-at-a-time insertion under every registered policy
+    printf("Insertion policy comparison (%d queries):\n", numPoints);
+    printf("  %-10s %12s %8s %8s %14s\n", "policy", "build (s)", "nodes",
+           "height", "visited/query");
+    for (int p = 0; RTreePolicies[p]; p++) {
+      struct RTreeContext pctx;
+      RTreeInitContext(&pctx);
+      RTreeSetPolicy(&pctx, RTreePolicies[p]);
+
+      start = GetTime();
+      struct Node *tree = BuildRTree(&pctx, &mesh);
+      end = GetTime();
+
+      TreeStats pstats;
+      ComputeTreeStats(&pctx, tree, &pstats);
+      int visited = 0;
+      for (int i = 0; i < numPoints; i++)
+        FindTriangleVisits(tree, &mesh, test_points[i], &visited);
+
+      printf("  %-10s %12.6f %8d %8d %14.2f\n", RTreePolicies[p]->name,
+             end - start, pstats.nodes, pstats.height,
+             numPoints ? (double)visited / numPoints : 0.0);
+      RTreeFreeIndex(&pctx);
+    }
+  }
+
+  if (concurrentTrees > 0) {
+    // Build the trees concurrently, then compare each one with the same tree
+    // built alone: same shape and same answers on the test points.
+    printf("Concurrent build check: %d trees on %d threads...\n",
+           concurrentTrees, numThreads);
+    ConcurrentBuild cb;
+    cb.mesh = &mesh;
+    cb.count = concurrentTrees;
+    cb.contexts = malloc(sizeof(struct RTreeContext) * concurrentTrees);
+    cb.roots = malloc(sizeof(struct Node *) * concurrentTrees);
+    for (int k = 0; k < concurrentTrees; k++) {
+      RTreeInitContext(&cb.contexts[k]);
+      RTreeSetLeafMax(&cb.contexts[k], ConcurrentLeafMax(k));
+    }
+
+    ThreadPool *pool = ThreadPoolCreate(numThreads);
+    if (!pool) {
+      printf("Failed to create the thread pool (out of memory)\n");
+      return 1;
+    }
+    start = GetTime();
+    ThreadPoolRun(pool, ConcurrentBuildTask, &cb);
+    end = GetTime();
+    ThreadPoolDestroy(pool);
+    printf("Built %d trees concurrently in %.6f seconds.\n", concurrentTrees,
+           end - start);
+
+    int failures = 0;
+    for (int k = 0; k < concurrentTrees; k++) {
+      struct RTreeContext refCtx;
+      RTreeInitContext(&refCtx);
+      RTreeSetLeafMax(&refCtx, ConcurrentLeafMax(k));
+      struct Node *ref = BuildRTree(&refCtx, &mesh);
+
+      TreeStats a, b;
+      ComputeTreeStats(&cb.contexts[k], cb.roots[k], &a);
+      ComputeTreeStats(&refCtx, ref, &b);
+      int same = a.nodes == b.nodes && a.leaves == b.leaves &&
+                 a.height == b.height && a.leafArea == b.leafArea &&
+                 a.overlap == b.overlap;
+      for (int i = 0; same && i < numPoints; i++)
+        same = FindTriangle(cb.roots[k], &mesh, test_points[i], NULL) ==
+               FindTriangle(ref, &mesh, test_points[i], NULL);
+      if (!same) {
+        printf("WARNING: concurrently built tree %d differs from the "
+               "reference!\n",
+               k);
+        failures++;
+      }
+      RTreeFreeIndex(&refCtx);
+      RTreeFreeIndex(&cb.contexts[k]);
+    }
+    if (!failures)
+      printf("Concurrent Build Check: PASS (%d trees match their reference)\n",
+             concurrentTrees);
+    free(cb.contexts);
+    free(cb.roots);
+  }
+
   free(test_points);
   dispose_mesh(&mesh);
-  /* Note: RTreeFreeNode(root) should be needed ?
-  Although the library has "RTreeFreeNode", it only frees one node.
-  Typically we'd need a recursive free, to deallocate its children nodes (and
-  their children nodes, etc). For this short lived program, OS will clean up.
-  */
+  RTreeFreeIndex(&ctx); // Every node of the tree, slab by slab
 
   return 0;
 }